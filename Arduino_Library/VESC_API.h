@@ -2,6 +2,10 @@
 #include <Arduino.h>
 #include <SPI.h>
 #include <mcp_can.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <freertos/semphr.h>
+#include "VESC_Core.h"
 
 // Hardware Configuration
 constexpr uint8_t PIN_SCK  = 6;
@@ -10,121 +14,241 @@ constexpr uint8_t PIN_MOSI = 7;
 constexpr uint8_t PIN_CS   = 10;
 constexpr uint8_t PIN_INT  = 4;
 
-// VESC Configuration
-constexpr uint8_t VESC_ID = 74;  // Default VESC ID (0x4A)
+// CAN Task Configuration
+constexpr uint16_t RX_RING_SIZE = 64;         // Frames buffered between the CAN task and update() (power of two)
+constexpr uint16_t TX_QUEUE_SIZE = 16;        // Frames waiting for a free MCP2515 TX buffer (power of two)
+constexpr uint32_t CAN_TASK_STACK = 3072;     // CAN task stack in bytes
+constexpr UBaseType_t CAN_TASK_PRIORITY = 5;  // Above loop() so the MCP2515 is serviced promptly
+constexpr uint32_t CAN_POLL_MS = 10;          // Re-check INT even if an edge was missed
+constexpr uint16_t RX_DRAIN_MAX = 32;         // Frames per wakeup before the CAN task yields
+constexpr uint8_t SERVICE_PASSES = 4;         // Rounds per wakeup while INT stays low
+constexpr uint32_t MCP_SPI_HZ = 10000000;     // MCP2515 SPI clock (same as mcp_can)
+constexpr BaseType_t CAN_TASK_CORE = tskNO_AFFINITY; // Any core; pin with setServiceTask() on dual-core chips
 
-// VESC CAN Message IDs
-enum VESCStatusMessage {
-  STATUS_1 = 0x8000094A,  // RPM, Current, Duty
-  STATUS_2 = 0x80000E4A,  // Amp Hours
-  STATUS_3 = 0x80000F4A,  // Watt Hours  
-  STATUS_4 = 0x8000104A,  // Temperatures, Current In
-  STATUS_5 = 0x80001B4A,  // Tacho, Voltage
-  STATUS_6 = 0x80001C4A   // ADC values
+// Bus Health Configuration
+constexpr uint32_t BUS_HEALTH_POLL_MS = 100;  // Read TEC/REC at least this often while error active
+constexpr uint32_t BUS_OFF_RESTART_MS = 100;  // Reset the MCP2515 if bus-off lasts this long (0 = never)
+
+// Command Keep-Alive Configuration
+constexpr uint8_t KEEPALIVE_SLOTS = 4;          // Controllers kept alive at once
+constexpr uint32_t KEEPALIVE_INTENT_MS = 1000;  // Default: stop re-sending when the app goes quiet this long
+
+// Where a received frame was lost
+enum VESCRxOverflow {
+  RX_OVERFLOW_RXB0 = 0,   // MCP2515 RXB0 full and could not roll over (RX0OVR)
+  RX_OVERFLOW_RXB1 = 1,   // MCP2515 RXB1 full (RX1OVR)
+  RX_OVERFLOW_RING = 2    // Receive ring full: update() or the decoder fell behind
 };
 
-// VESC Command IDs (as per VESC protocol)
-enum VESCCommandID {
-  CMD_SET_DUTY = 0,        // Set duty cycle
-  CMD_SET_CURRENT = 1,     // Set motor current
-  CMD_SET_CURRENT_BRAKE = 2, // Set brake current
-  CMD_SET_RPM = 3,         // Set RPM
-  CMD_SET_POS = 4          // Set position
+// VESCClock on the Arduino millis()/micros() counters
+class VESCArduinoClock : public VESCClock {
+public:
+  uint32_t millis() override;
+  uint32_t micros() override;
 };
 
-// VESC Data Structure
-struct VESCData {
-  // Motor data
-  float rpm;
-  float duty_cycle;
-  float motor_current;
-  float input_current;
-  
-  // Power data
-  float input_voltage;
-  float amp_hours;
-  float amp_hours_charged;
-  float watt_hours;
-  float watt_hours_charged;
-  
-  // Temperature data
-  float fet_temp;
-  float motor_temp;
-  
-  // Position data
-  float pid_position;
-  float tacho_value;
-  
-  // ADC inputs
-  float adc1;
-  float adc2;
-  float adc3;
-  float ppm;
-  
-  // System info
-  unsigned long last_update;
-  unsigned long message_count;
-  bool data_valid;
+// VESCCanBus on an MCP2515. A CAN task owns the chip: the INT line wakes it
+// to drain received frames into a lock-free ring, which receive() empties,
+// and to feed queued frames from send() into the three TX buffers.
+class VESCMCP2515Bus : public VESCCanBus {
+public:
+  VESCMCP2515Bus();
+  
+  bool begin();               // Start SPI, the MCP2515 and the CAN task
+  
+  // Bus Health
+  VESCBusHealth getBusHealth();         // Error counters, state and transition counts
+  VESCBusState getBusState();
+  void setBusOffRestart(uint32_t ms);   // Reset the MCP2515 after this long in bus-off (0 = never)
+  void onBusStateChange(void (*callback)(VESCBusState state)); // Runs in the CAN task: keep it short
+  
+  // CAN Task (call before begin())
+  void setTask(UBaseType_t priority, uint32_t stack_bytes, BaseType_t core);
+  void setReceiveHook(void (*hook)(void* ctx), void* ctx); // Run in the CAN task on every wakeup, after draining
+  uint32_t getTaskStackFree();          // Lowest free stack seen so far, in bytes
+  
+  // VESCCanBus
+  bool send(const VESCFrame& frame) override;  // Queues the frame, false if the queue is full
+  bool receive(VESCFrame& frame) override;
+  uint16_t pending() override;
+  
+  // Hardware Filtering
+  bool setHardwareFilter(bool enabled); // Only accept VESC status frames in the MCP2515
+  bool isHardwareFilterEnabled();
+  unsigned long getRxFrameCount();      // Frames read from the MCP2515 over SPI
+  unsigned long getDroppedFrameCount(); // Frames lost because the ring was full
+  
+  // Receive Overflow
+  unsigned long getRxOverflowCount();   // Frames lost anywhere between the bus and the decoder
+  unsigned long getRxOverflowCount(VESCRxOverflow where);
+  void onRxOverflow(void (*callback)(VESCRxOverflow where)); // Runs in the CAN task: keep it short
+  
+  // Transmit Statistics
+  uint16_t getTxQueued();               // Frames waiting for a TX buffer
+  unsigned long getTxFrameCount();      // Frames the MCP2515 reported as sent
+  unsigned long getTxErrorCount();      // Bus errors reported while sending
+  unsigned long getTxOverflowCount();   // Frames refused because the queue was full
+  
+  // Command Coalescing
+  void setTxCoalescing(bool enabled);   // Replace queued setpoints instead of queuing behind them
+  unsigned long getTxCoalescedCount();  // Frames coalescing kept off the bus
+  unsigned long getTxCoalescedCount(VESCCommandID cmd_id);
+  
+  // One-Shot Transmission
+  void setOneShot(bool enabled);        // All setpoint commands: one attempt, no retransmission
+  void setOneShot(VESCCommandID cmd_id, bool enabled);
+  unsigned long getOneShotSentCount();  // One-shot frames that made it onto the bus
+  unsigned long getOneShotFailedCount(); // One-shot frames lost to arbitration or errors
+  
+  // Command Keep-Alive
+  void setKeepAlive(uint32_t period_ms, uint32_t intent_timeout_ms);
+  void releaseKeepAlive(uint8_t controller_id); // Stop re-sending to one controller
+  unsigned long getKeepAliveSentCount(); // Frames re-sent by the keep-alive
+
+private:
+  MCP_CAN can;
+  
+  // Interrupt-driven receive path
+  VESCFrameRing<RX_RING_SIZE> rxRing;
+  SemaphoreHandle_t canMutex;     // Serializes SPI access between the CAN task and setHardwareFilter()
+  unsigned long rx_dropped;       // Frames lost because the ring was full
+  unsigned long rx_frames;        // Frames read over SPI
+  unsigned long rx_overflow[2];   // RX0OVR / RX1OVR events
+  uint8_t rx_overflow_events;     // Bit per VESCRxOverflow since the last callback
+  void (*rx_overflow_callback)(VESCRxOverflow where);
+  bool hw_filter;
+  
+  // Queued transmit path
+  VESCFrameRing<TX_QUEUE_SIZE> txRing;
+  uint8_t tx_priority[3];         // TXP of the frame loaded in each TX buffer
+  unsigned long tx_frames;
+  unsigned long tx_errors;
+  unsigned long tx_overflow;
+  uint16_t tx_dead;               // Queue entries superseded by a newer setpoint
+  unsigned long tx_coalesced[CMD_SET_POS + 1];
+  bool tx_coalesce;
+  uint8_t tx_loaded;              // TX buffers holding a frame we have not seen finish
+  uint8_t tx_loaded_one_shot;     // ... of which were sent one-shot
+  uint8_t one_shot_commands;      // Bit per VESCCommandID sent one-shot
+  bool osm_active;                // CANCTRL.OSM as last written
+  unsigned long one_shot_sent;
+  unsigned long one_shot_failed;
+  
+  // Keep-alive: last setpoint per controller, re-sent by the CAN task
+  struct KeepAlive {
+    VESCFrame frame;
+    uint32_t last_sent_ms;        // Last time this setpoint went into the queue
+    uint32_t intent_ms;           // Last time the app itself sent it
+    bool active;
+  };
+  KeepAlive keepalive[KEEPALIVE_SLOTS];
+  uint32_t keepalive_period_ms;   // 0 = off
+  uint32_t keepalive_intent_ms;
+  unsigned long keepalive_sent;
+  
+  // CAN task
+  UBaseType_t task_priority;
+  uint32_t task_stack;
+  BaseType_t task_core;
+  void (*rx_hook)(void* ctx);
+  void* rx_hook_ctx;
+  
+  // Bus health, read from EFLG/TEC/REC by the CAN task
+  VESCBusHealth health;
+  uint32_t health_polled_ms;
+  uint32_t bus_off_restart_ms;
+  bool bus_state_changed;         // Since the last callback
+  void (*bus_state_callback)(VESCBusState state);
+  bool int_held;                  // INT still low after service()
+  
+  static void canTaskEntry(void* arg);
+  uint16_t service(bool edge);
+  uint8_t loadTxBuffers(uint8_t status);
+  bool serviceErrorState(uint32_t now);
+  bool startController();
+  bool writeFilters(bool enabled);
+  bool coalesce(const VESCFrame& frame);
+  bool isOneShot(const VESCFrame& frame);
+  void trackKeepAlive(const VESCFrame& frame, uint32_t now);
+  uint32_t serviceKeepAlive();
+  
+  // Raw MCP2515 access for the hot paths
+  uint8_t readRegister(uint8_t address);
+  void modifyRegister(uint8_t address, uint8_t mask, uint8_t value);
+  uint8_t readStatus();
+  void readRxBuffer(uint8_t n, VESCFrame& frame);
+  void loadTxBuffer(uint8_t n, const VESCFrame& frame, uint8_t priority);
 };
 
 // VESC API Class
-class VESC_API {
+// The protocol core (readers, commands, update()) comes from VESCCore; this
+// class wires it to the MCP2515 and adds Serial diagnostics.
+class VESC_API : public VESCCore {
 public:
   // Constructor
   VESC_API();
   
-  // Initialization
-  bool init();
-  
-  // Data Reading Functions (for students)
-  float getRPM();
-  float getDuty();            // Returns duty cycle as percentage (0-100)
-  float getMotorCurrent();    // Returns motor current in Amps
-  float getBatteryCurrent();  // Returns battery current in Amps
-  float getVoltage();         // Returns input voltage in Volts
-  float getFETTemp();         // Returns FET temperature in Celsius
-  float getMotorTemp();       // Returns motor temperature in Celsius
-  float getAmpHours();        // Returns consumed amp hours
-  float getWattHours();       // Returns consumed watt hours
-  
-  // Command Functions (for students)
-  void setDutyCycle(float duty);    // Set duty cycle (-100 to 100)
-  void setCurrent(float current);   // Set motor current in Amps
-  void setCurrentBrake(float current); // Set brake current in Amps
-  void setBrake(float brake);       // Set brake (0-100)
-  void setRPM(float rpm);           // Set RPM
-  
-  // System Functions
-  void update();              // Call this in loop() to process CAN messages
-  bool isConnected();         // Returns true if VESC is responding
-  unsigned long getLastUpdate(); // Returns time of last VESC message
+  // Initialization. layout is sizeof(VESC_API) as the sketch sees it; leave
+  // it to the default, init() fails if it differs from the library's.
+  bool init(size_t layout = sizeof(VESC_API));
+  
+  // CAN Service Task (call before init())
+  // With decode on, the CAN task decodes frames as they arrive and update()
+  // does nothing: read with getSnapshot() from loop() or any other task.
+  void setServiceTask(bool decode, UBaseType_t priority = CAN_TASK_PRIORITY,
+                      uint32_t stack_bytes = CAN_TASK_STACK, BaseType_t core = CAN_TASK_CORE);
+  bool isServiceTaskDecoding();
+  uint16_t update();                    // Decode queued frames (no-op when the CAN task decodes)
+  uint16_t update(uint16_t max_frames, uint32_t max_micros);
+  
+  // Hardware Filtering
+  bool setHardwareFilter(bool enabled); // Only accept VESC status frames in the MCP2515
+  bool isHardwareFilterEnabled();
+  unsigned long getRxFrameCount();      // Frames read from the MCP2515 over SPI
+  
+  // Bus Health
+  VESCBusHealth getBusHealth();         // TEC/REC, error state and how often it got worse
+  VESCBusState getBusState();           // BUS_ERROR_ACTIVE, _WARNING, _PASSIVE or BUS_OFF
+  void setBusOffRestart(uint32_t ms);   // Reset the MCP2515 after this long in bus-off (0 = never)
+  void onBusStateChange(void (*callback)(VESCBusState state)); // Called from the CAN task on every change
+  
+  // Receive Overflow
+  unsigned long getRxOverflowCount();   // Frames lost before they could be decoded
+  unsigned long getRxOverflowCount(VESCRxOverflow where);
+  void onRxOverflow(void (*callback)(VESCRxOverflow where)); // Called from the CAN task when frames are lost
+  
+  // Transmit Statistics
+  uint16_t getTxQueued();               // Commands waiting for a TX buffer
+  unsigned long getTxFrameCount();      // Commands the MCP2515 reported as sent
+  unsigned long getTxErrorCount();      // Bus errors reported while sending
+  
+  // Command Coalescing
+  void setTxCoalescing(bool enabled);   // New setpoints replace queued ones (on by default)
+  unsigned long getTxCoalescedCount();  // Commands replaced before they were sent
+  
+  // One-Shot Transmission
+  void setOneShot(bool enabled);        // Setpoints get one attempt: a late retry never overtakes a newer value
+  void setOneShot(VESCCommandID cmd_id, bool enabled);
+  unsigned long getOneShotFailedCount(); // One-shot commands that did not get through
+  
+  // Command Keep-Alive
+  void setKeepAlive(uint32_t period_ms, uint32_t intent_timeout_ms = KEEPALIVE_INTENT_MS); // Re-send the last setpoint (0 = off)
+  void release(uint8_t controller_id = VESC_ID); // Stop keep-alive and release the motor
   
   // Debug Functions
   void printStatus();         // Print all telemetry data
   void printDebug();          // Print debug information
-  
+
+protected:
+  void waitForReply() override;
+
 private:
-  MCP_CAN can;
-  VESCData data;
-  
-  // Internal helper functions
-  bool parseVESCMessage(uint32_t id, uint8_t len, uint8_t* msg_data);
-  void parseStatus1(uint8_t* msg_data);
-  void parseStatus2(uint8_t* msg_data);
-  void parseStatus3(uint8_t* msg_data);
-  void parseStatus4(uint8_t* msg_data);
-  void parseStatus5(uint8_t* msg_data);
-  void parseStatus6(uint8_t* msg_data);
-  bool isStatusMessage(uint32_t id);
-  
-  // Utility functions
-  int32_t buffer_get_int32(const uint8_t* buffer, int32_t* index);
-  int16_t buffer_get_int16(const uint8_t* buffer, int32_t* index);
-  
-  // Command sending
-  void sendCommand(uint32_t id, uint8_t* data, uint8_t len);
-  uint32_t getCommandID(VESCCommandID cmd_id);
+  VESCMCP2515Bus mcp;
+  VESCArduinoClock arduinoClock;
+  bool task_decode;
+  
+  static void decodeInTask(void* ctx);
 };
 
 // Global VESC instance for easy access
-extern VESC_API vesc;
\ No newline at end of file
+extern VESC_API vesc;
@@ -3,154 +3,1072 @@
 // Global VESC instance
 VESC_API vesc;
 
-// Constructor
-VESC_API::VESC_API() : can(PIN_CS) {
-  memset(&data, 0, sizeof(data));
-  data.data_valid = false;
+// MCP2515 SPI instructions and registers used directly (mcp_can does the rest)
+static constexpr uint8_t MCP2515_WRITE       = 0x02;
+static constexpr uint8_t MCP2515_READ        = 0x03;
+static constexpr uint8_t MCP2515_BIT_MODIFY  = 0x05;
+static constexpr uint8_t MCP2515_LOAD_TX     = 0x40;  // | 2 * buffer, starts at TXBnSIDH
+static constexpr uint8_t MCP2515_READ_RX     = 0x90;  // | 4 * buffer, starts at RXBnSIDH, clears RXnIF
+static constexpr uint8_t MCP2515_READ_STATUS = 0xA0;
+static constexpr uint8_t MCP2515_TEC         = 0x1C;
+static constexpr uint8_t MCP2515_REC         = 0x1D;
+static constexpr uint8_t MCP2515_CANCTRL     = 0x0F;
+static constexpr uint8_t MCP2515_CANINTE     = 0x2B;
+static constexpr uint8_t MCP2515_CANINTF     = 0x2C;
+static constexpr uint8_t MCP2515_EFLG        = 0x2D;
+static constexpr uint8_t MCP2515_RXB0CTRL    = 0x60;
+static constexpr uint8_t MCP2515_TXB0CTRL    = 0x30;  // + 0x10 * buffer
+
+// CANINTE / CANINTF bits
+static constexpr uint8_t INT_RX0 = 0x01;
+static constexpr uint8_t INT_RX1 = 0x02;
+static constexpr uint8_t INT_TX0 = 0x04;  // << buffer
+static constexpr uint8_t INT_ERR = 0x20;  // EFLG changed
+static constexpr uint8_t INT_MERR = 0x80;
+
+// EFLG bits
+static constexpr uint8_t EFLG_TXBO = 0x20;
+static constexpr uint8_t EFLG_RX0OVR = 0x40;
+static constexpr uint8_t EFLG_RX1OVR = 0x80;
+
+// RXB0CTRL
+static constexpr uint8_t RXB0_BUKT = 0x04;  // Roll over into RXB1 when RXB0 is full
+
+// READ STATUS bits
+static constexpr uint8_t STAT_RX0IF = 0x01;
+static constexpr uint8_t STAT_RX1IF = 0x02;
+static constexpr uint8_t STAT_TXREQ0 = 0x04;  // << 2 * buffer
+static constexpr uint8_t STAT_TX0IF = 0x08;   // << 2 * buffer
+
+// TXBnCTRL
+static constexpr uint8_t TXB_TXREQ = 0x08;
+
+// CANCTRL
+static constexpr uint8_t CANCTRL_OSM = 0x08;
+
+// len of a TX queue entry superseded by coalescing
+static constexpr uint8_t TX_FRAME_DEAD = 0xFF;
+
+// Task woken by the MCP2515 INT line and by send()
+static TaskHandle_t canTaskHandle = nullptr;
+
+// Lets several tasks share the single-producer TX queue
+static portMUX_TYPE txMux = portMUX_INITIALIZER_UNLOCKED;
+
+// Task notification bits: why the CAN task woke up
+static constexpr uint32_t NOTIFY_INT = 0x01;  // INT edge from the MCP2515
+static constexpr uint32_t NOTIFY_TX  = 0x02;  // send(), setKeepAlive() or a deferred burst
+
+// micros() at the latest INT edge, the closest we get to the frame's arrival
+static volatile uint32_t edgeMicros = 0;
+
+// Setpoint commands (duty, current, brake, RPM, position); sets *cmd_id
+static bool isSetpoint(const VESCFrame& frame, uint8_t* cmd_id) {
+  *cmd_id = (frame.id >> 8) & 0xFF;
+  return (frame.id & (CAN_ID_EXTENDED | CAN_ID_REMOTE | 0x1FFF0000)) == CAN_ID_EXTENDED && *cmd_id <= CMD_SET_POS;
 }
 
-// Initialize VESC CAN system
-bool VESC_API::init() {
-  Serial.println("Initializing VESC CAN system...");
-  
+// INT falls when the MCP2515 has received or sent a frame. SPI cannot be used
+// from ISR context on ESP32, so the ISR only wakes the CAN task.
+static void IRAM_ATTR onCanInterrupt() {
+  edgeMicros = micros();
+  BaseType_t woken = pdFALSE;
+  xTaskNotifyFromISR(canTaskHandle, NOTIFY_INT, eSetBits, &woken);
+  if (woken == pdTRUE) {
+    portYIELD_FROM_ISR();
+  }
+}
+
+// Arduino clock
+uint32_t VESCArduinoClock::millis() {
+  return ::millis();
+}
+
+uint32_t VESCArduinoClock::micros() {
+  return ::micros();
+}
+
+// MCP2515 transport
+VESCMCP2515Bus::VESCMCP2515Bus()
+  : can(PIN_CS), canMutex(nullptr), rx_dropped(0), rx_frames(0), rx_overflow{0, 0},
+    rx_overflow_events(0), rx_overflow_callback(nullptr), hw_filter(false),
+    tx_priority{0, 0, 0}, tx_frames(0), tx_errors(0), tx_overflow(0), tx_dead(0),
+    tx_coalesced{0, 0, 0, 0, 0}, tx_coalesce(true), tx_loaded(0), tx_loaded_one_shot(0),
+    one_shot_commands(0), osm_active(false), one_shot_sent(0), one_shot_failed(0),
+    keepalive_period_ms(0), keepalive_intent_ms(KEEPALIVE_INTENT_MS), keepalive_sent(0),
+    task_priority(CAN_TASK_PRIORITY), task_stack(CAN_TASK_STACK), task_core(CAN_TASK_CORE),
+    rx_hook(nullptr), rx_hook_ctx(nullptr), health_polled_ms(0), bus_off_restart_ms(BUS_OFF_RESTART_MS),
+    bus_state_changed(false), bus_state_callback(nullptr), int_held(false) {
+  memset(keepalive, 0, sizeof(keepalive));
+  memset(&health, 0, sizeof(health));
+}
+
+bool VESCMCP2515Bus::begin() {
   // Initialize SPI
   SPI.begin(PIN_SCK, PIN_MISO, PIN_MOSI, PIN_CS);
   
   // Initialize CAN
-  if (can.begin(MCP_STDEXT, CAN_500KBPS, MCP_16MHZ) != CAN_OK) {
+  if (!startController()) {
     Serial.println("ERROR: CAN initialization failed!");
     return false;
   }
+  pinMode(PIN_INT, INPUT_PULLUP);
+  
+  // Keep other nodes' traffic (BMS, lights, ...) off the SPI bus
+  if (!setHardwareFilter(true)) {
+    Serial.println("WARNING: Could not program CAN filters, receiving all frames");
+  }
+  
+  // Start the CAN task before enabling the interrupt that wakes it
+  canMutex = xSemaphoreCreateMutex();
+  if (canMutex == nullptr ||
+      xTaskCreatePinnedToCore(canTaskEntry, "vesc_can", task_stack, this, task_priority,
+                              &canTaskHandle, task_core) != pdPASS) {
+    Serial.println("ERROR: Could not start CAN task!");
+    return false;
+  }
+  attachInterrupt(digitalPinToInterrupt(PIN_INT), onCanInterrupt, FALLING);
+  return true;
+}
+
+// Only queues the frame; the CAN task loads it into a TX buffer. Safe to
+// call from any task.
+bool VESCMCP2515Bus::send(const VESCFrame& frame) {
+  if (canTaskHandle == nullptr) {
+    return false; // init() not called yet
+  }
+  
+  uint32_t now = millis();
+  portENTER_CRITICAL(&txMux);
+  bool queued = (tx_coalesce && coalesce(frame)) || txRing.push(frame);
+  if (queued && keepalive_period_ms != 0) {
+    trackKeepAlive(frame, now);
+  }
+  if (!queued) {
+    tx_overflow++;
+  }
+  portEXIT_CRITICAL(&txMux);
   
+  if (!queued) {
+    return false;
+  }
+  xTaskNotify(canTaskHandle, NOTIFY_TX, eSetBits);
+  return true;
+}
+
+// Reset the MCP2515 and bring it up in normal mode with our interrupts.
+// Filters are left open.
+bool VESCMCP2515Bus::startController() {
+  if (can.begin(MCP_STDEXT, CAN_500KBPS, MCP_16MHZ) != CAN_OK) {
+    return false;
+  }
   can.setMode(MCP_NORMAL);
-  pinMode(PIN_INT, INPUT_PULLUP);
   
-  Serial.println("VESC CAN system ready!");
+  // A frame arriving while RXB0 is still full moves on to RXB1 instead of
+  // being lost
+  modifyRegister(MCP2515_RXB0CTRL, RXB0_BUKT, RXB0_BUKT);
+  
+  // mcp_can only enables the RX interrupts; completions and errors of our
+  // own transmissions, and EFLG changes (receive overflow, error counter
+  // levels), wake the CAN task too
+  const uint8_t interrupts = (INT_TX0 << 0) | (INT_TX0 << 1) | (INT_TX0 << 2) | INT_ERR | INT_MERR;
+  modifyRegister(MCP2515_CANINTE, interrupts, interrupts);
   return true;
 }
 
-// Update function - call this in loop()
-void VESC_API::update() {
-  // Process all available CAN messages
-  while (!digitalRead(PIN_INT)) {
-    uint32_t id;
-    uint8_t len;
-    uint8_t msg_data[8];
-    
-    if (can.readMsgBuf(&id, &len, msg_data) == CAN_OK) {
-      parseVESCMessage(id, len, msg_data);
+bool VESCMCP2515Bus::receive(VESCFrame& frame) {
+  return rxRing.pop(frame);
+}
+
+uint16_t VESCMCP2515Bus::pending() {
+  return rxRing.size();
+}
+
+// CAN task - sleeps until the INT edge or a send(), then services the MCP2515
+void VESCMCP2515Bus::canTaskEntry(void* arg) {
+  VESCMCP2515Bus* self = static_cast<VESCMCP2515Bus*>(arg);
+  uint32_t wait_ms = CAN_POLL_MS;
+  for (;;) {
+    // The timeout catches an edge that fell while we were still busy, and
+    // wakes us in time for the next keep-alive
+    uint32_t reason = 0;
+    xTaskNotifyWait(0, UINT32_MAX, &reason, pdMS_TO_TICKS(wait_ms));
+    wait_ms = self->serviceKeepAlive();
+    uint16_t count = self->service(reason & NOTIFY_INT);
+    // Every wakeup, not only those that brought frames: the hook's periodic
+    // work (setPingInterval()) must go on while the bus is quiet
+    if (self->rx_hook != nullptr) {
+      self->rx_hook(self->rx_hook_ctx);
+    }
+    if (self->bus_state_changed) {
+      self->bus_state_changed = false;
+      if (self->bus_state_callback != nullptr) {
+        self->bus_state_callback(self->health.state);
+      }
+    }
+    if (self->rx_overflow_events != 0) {
+      uint8_t events = self->rx_overflow_events;
+      self->rx_overflow_events = 0;
+      for (uint8_t i = 0; i <= RX_OVERFLOW_RING; i++) {
+        if ((events & (1 << i)) && self->rx_overflow_callback != nullptr) {
+          self->rx_overflow_callback((VESCRxOverflow)i);
+        }
+      }
+    }
+    if (count >= RX_DRAIN_MAX || self->int_held) {
+      // Still busy after a full burst (flood or babbling node), or INT did
+      // not go high: give lower priority tasks a tick before carrying on
+      vTaskDelay(1);
+      xTaskNotify(canTaskHandle, NOTIFY_TX, eSetBits);
     }
   }
 }
 
-// Student-friendly data reading functions
-float VESC_API::getRPM() {
-  return data.rpm;
+// Read up to RX_DRAIN_MAX frames, acknowledge finished transmissions and
+// refill free TX buffers. edge is true when an INT edge woke the task.
+// Returns frames read.
+uint16_t VESCMCP2515Bus::service(bool edge) {
+  uint16_t count = 0;
+  
+  xSemaphoreTake(canMutex, portMAX_DELAY);
+  uint8_t status = readStatus();
+  uint8_t flags = 0;
+  
+  // The edge time belongs to a frame only if a receive pulled INT low. With
+  // a TX or error flag also set, the edge may have come from that, before
+  // the frame arrived, so the frame gets the time it is read instead.
+  if (edge) {
+    const uint8_t other = (INT_TX0 << 0) | (INT_TX0 << 1) | (INT_TX0 << 2) | INT_ERR | INT_MERR;
+    edge = (readRegister(MCP2515_CANINTF) & other) == 0;
+  }
+  
+  // INT is only low while a flag is set, but we wake on its falling edge:
+  // a frame that lands while a TX or error flag holds INT low makes no edge
+  // of its own once that flag is cleared. So go round until INT is released.
+  for (uint8_t pass = 0; ; pass++) {
+    // RXB0 first: it holds the higher priority filter matches
+    // The first frame after an RX edge is the one that pulled INT low;
+    // frames that arrive while we drain get the time they were read
+    while (count < RX_DRAIN_MAX && (status & (STAT_RX0IF | STAT_RX1IF))) {
+      VESCFrame frame;
+      readRxBuffer((status & STAT_RX0IF) ? 0 : 1, frame);
+      frame.timestamp = edge ? edgeMicros : micros();
+      edge = false;
+      rx_frames++;
+      count++;
+      if (!rxRing.push(frame)) {
+        rx_dropped++;
+        rx_overflow_events |= 1 << RX_OVERFLOW_RING;
+      }
+      status = readStatus();
+    }
+    
+    // Finished transmissions. TXnIF means sent; a buffer we loaded whose
+    // TXREQ cleared without TXnIF was aborted, which in one-shot mode means
+    // it lost arbitration or hit an error. Aborts raise no interrupt, so
+    // those are noticed on the next wakeup.
+    uint8_t done = 0;
+    for (uint8_t n = 0; n < 3; n++) {
+      bool sent = status & (STAT_TX0IF << (2 * n));
+      bool busy = status & (STAT_TXREQ0 << (2 * n));
+      bool one_shot = tx_loaded_one_shot & (1 << n);
+      if (sent) {
+        done |= INT_TX0 << n;
+        tx_frames++;
+        one_shot_sent += one_shot;
+      } else if (!busy && (tx_loaded & (1 << n))) {
+        one_shot_failed += one_shot;
+      }
+      if (sent || !busy) {
+        tx_loaded &= ~(1 << n);
+        tx_loaded_one_shot &= ~(1 << n);
+      }
+    }
+    if (done != 0) {
+      modifyRegister(MCP2515_CANINTF, done, 0);
+    }
+    
+    // Error frame while sending (the MCP2515 retries on its own), or an EFLG
+    // change. Either keeps INT low once the receive buffers are empty.
+    if (!digitalRead(PIN_INT)) {
+      uint8_t err = readRegister(MCP2515_CANINTF) & (INT_ERR | INT_MERR);
+      if (err & INT_MERR) {
+        tx_errors++;
+      }
+      if (err != 0) {
+        modifyRegister(MCP2515_CANINTF, err, 0);
+      }
+      flags |= err;
+    }
+    
+    // Every flag we enable has been cleared, so INT still low means a new
+    // one was set meanwhile. A burst is left to the deferred wakeup, and a
+    // line that will not let go to the next tick.
+    int_held = false;
+    if (digitalRead(PIN_INT) || count >= RX_DRAIN_MAX) {
+      break;
+    }
+    if (pass + 1 >= SERVICE_PASSES) {
+      int_held = true;
+      break;
+    }
+    status = readStatus();
+  }
+  
+  // Error counters change without an interrupt until they cross a level, so
+  // they are also polled: often while the bus is in trouble, rarely when not
+  uint32_t now = millis();
+  uint32_t poll_ms = health.state == BUS_ERROR_ACTIVE ? BUS_HEALTH_POLL_MS : CAN_POLL_MS;
+  if ((flags & INT_ERR) || now - health_polled_ms >= poll_ms) {
+    health_polled_ms = now;
+    if (serviceErrorState(now)) {
+      status = readStatus(); // The controller was reset
+    }
+  }
+  
+  loadTxBuffers(status);
+  xSemaphoreGive(canMutex);
+  return count;
 }
 
-float VESC_API::getDuty() {
-  return data.duty_cycle * 100.0f; // Convert to percentage
+// Read EFLG and the error counters. Counts and clears receive overflows
+// (the MCP2515 keeps RXnOVR set until cleared by hand), tracks the error
+// state and resets the controller when bus-off outlasts bus_off_restart_ms.
+// Returns true if it did.
+bool VESCMCP2515Bus::serviceErrorState(uint32_t now) {
+  uint8_t eflg = readRegister(MCP2515_EFLG);
+  uint8_t tec = readRegister(MCP2515_TEC);
+  uint8_t rec = readRegister(MCP2515_REC);
+  if (health.update(tec, rec, eflg & EFLG_TXBO, now)) {
+    bus_state_changed = true;
+  }
+  
+  // The MCP2515 rejoins by itself after 128 x 11 recessive bits. If it has
+  // not by now, the bus is stuck or we keep destroying our own frames:
+  // start over with clean counters and empty TX buffers.
+  if (health.state == BUS_OFF && bus_off_restart_ms != 0 &&
+      now - health.state_since_ms >= bus_off_restart_ms) {
+    bool filter = hw_filter;
+    if (startController()) {
+      writeFilters(filter);
+      one_shot_failed += ((tx_loaded_one_shot >> 0) & 1) + ((tx_loaded_one_shot >> 1) & 1) +
+                         ((tx_loaded_one_shot >> 2) & 1);
+      tx_loaded = 0;
+      tx_loaded_one_shot = 0;
+      osm_active = false;
+      health.restarts++;
+      health.update(0, 0, false, now);
+      bus_state_changed = true;
+    } else {
+      health.state_since_ms = now; // Try again after another period
+    }
+    return true;
+  }
+  
+  uint8_t overflow = eflg & (EFLG_RX0OVR | EFLG_RX1OVR);
+  if (overflow == 0) {
+    return false;
+  }
+  if (overflow & EFLG_RX0OVR) {
+    rx_overflow[RX_OVERFLOW_RXB0]++;
+    rx_overflow_events |= 1 << RX_OVERFLOW_RXB0;
+  }
+  if (overflow & EFLG_RX1OVR) {
+    rx_overflow[RX_OVERFLOW_RXB1]++;
+    rx_overflow_events |= 1 << RX_OVERFLOW_RXB1;
+  }
+  modifyRegister(MCP2515_EFLG, overflow, 0);
+  return false;
 }
 
-float VESC_API::getMotorCurrent() {
-  return data.motor_current;
+// Move queued frames into free TX buffers. Each frame is ranked below every
+// frame still waiting in the chip, so the MCP2515 sends them in queue order
+// while all three buffers contend for the bus. Between equal TXPs the higher
+// buffer number goes first, so a frame keeps the TXP of the last one if a
+// lower numbered buffer is free and only steps down a level otherwise. A
+// pending TXP cannot be raised again, so once the last frame waits at TXP 0
+// in the lowest free buffer the rest wait for it. Returns frames loaded.
+uint8_t VESCMCP2515Bus::loadTxBuffers(uint8_t status) {
+  uint8_t loaded = 0;
+  
+  while (txRing.size() > 0) {
+    uint8_t lowest = 4;          // Lowest TXP still pending, 4 = none pending
+    uint8_t lowest_buffer = 3;   // Its buffer, the lowest numbered on a tie
+    for (uint8_t n = 0; n < 3; n++) {
+      if ((status & (STAT_TXREQ0 << (2 * n))) && tx_priority[n] < lowest) {
+        lowest = tx_priority[n];
+        lowest_buffer = n;
+      }
+    }
+    int8_t free_buffer = -1;
+    uint8_t priority = lowest == 4 ? 3 : lowest;
+    for (int8_t n = lowest_buffer - 1; n >= 0 && free_buffer < 0; n--) {
+      if (!(status & (STAT_TXREQ0 << (2 * n)))) {
+        free_buffer = n;
+      }
+    }
+    for (int8_t n = 2; n >= 0 && free_buffer < 0 && lowest != 0 && lowest != 4; n--) {
+      if (!(status & (STAT_TXREQ0 << (2 * n)))) {
+        free_buffer = n;
+        priority = lowest - 1;
+      }
+    }
+    if (free_buffer < 0) {
+      break; // No buffer, or no rank left below the pending ones
+    }
+    
+    // Look at the next live frame without taking it yet
+    VESCFrame frame;
+    bool found = false;
+    portENTER_CRITICAL(&txMux);
+    while (!found && txRing.size() > 0) {
+      if (txRing.peek(0).len == TX_FRAME_DEAD) {
+        txRing.pop(frame);
+        tx_dead--;
+      } else {
+        frame = txRing.peek(0);
+        found = true;
+      }
+    }
+    portEXIT_CRITICAL(&txMux);
+    if (!found) {
+      break;
+    }
+    
+    // OSM applies to every buffer, so one-shot and normal frames are never
+    // in the chip together: switch only once the other kind has drained
+    bool one_shot = isOneShot(frame);
+    if (one_shot != osm_active) {
+      if (lowest != 4) {
+        break;
+      }
+      modifyRegister(MCP2515_CANCTRL, CANCTRL_OSM, one_shot ? CANCTRL_OSM : 0);
+      osm_active = one_shot;
+    }
+    
+    // Take it; coalescing may have replaced it with a newer value meanwhile
+    portENTER_CRITICAL(&txMux);
+    txRing.pop(frame);
+    bool dead = frame.len == TX_FRAME_DEAD;
+    if (dead) {
+      tx_dead--;
+    }
+    portEXIT_CRITICAL(&txMux);
+    if (dead) {
+      continue;
+    }
+    
+    loadTxBuffer(free_buffer, frame, priority);
+    tx_priority[free_buffer] = priority;
+    tx_loaded |= 1 << free_buffer;
+    if (one_shot) {
+      tx_loaded_one_shot |= 1 << free_buffer;
+    }
+    status |= STAT_TXREQ0 << (2 * free_buffer);
+    loaded++;
+  }
+  return loaded;
 }
 
-float VESC_API::getBatteryCurrent() {
-  return data.input_current;
+// Latest-wins setpoints: a command replaces the queued one of the same type
+// for the same controller. It is overwritten in place when nothing else for
+// that controller is queued behind it, otherwise the old entry is marked dead
+// and the new one appended, so the controller still sees commands in the
+// order they were issued. Called with txMux held; true if frame was absorbed.
+bool VESCMCP2515Bus::coalesce(const VESCFrame& frame) {
+  uint8_t cmd_id;
+  if (!isSetpoint(frame, &cmd_id)) {
+    return false; // Only setpoints; buffer transfers and pings are never merged
+  }
+  
+  bool later = false;   // Another frame for this controller is queued after the match
+  for (int16_t i = txRing.size() - 1; i >= 0; i--) {
+    VESCFrame& queued = txRing.peek(i);
+    if (queued.len == TX_FRAME_DEAD || (queued.id & 0x1FFF00FF) != (frame.id & 0x1FFF00FF)) {
+      continue; // Superseded, or for another controller
+    }
+    if (queued.id != frame.id) {
+      later = true;
+      continue;
+    }
+    
+    if (!later) {
+      queued = frame;
+      tx_coalesced[cmd_id]++;
+      return true;
+    }
+    if (txRing.size() < TX_QUEUE_SIZE) { // Else no room to append: leave the queue as it is
+      queued.len = TX_FRAME_DEAD;
+      tx_dead++;
+      tx_coalesced[cmd_id]++;
+    }
+    return false;
+  }
+  return false;
 }
 
-float VESC_API::getVoltage() {
-  return data.input_voltage;
+// Remember the setpoint the app just sent. Called with txMux held.
+void VESCMCP2515Bus::trackKeepAlive(const VESCFrame& frame, uint32_t now) {
+  uint8_t cmd_id;
+  if (!isSetpoint(frame, &cmd_id)) {
+    return;
+  }
+  
+  KeepAlive* slot = nullptr;
+  for (uint8_t i = 0; i < KEEPALIVE_SLOTS; i++) {
+    KeepAlive& k = keepalive[i];
+    if (k.active && (k.frame.id & 0xFF) == (frame.id & 0xFF)) {
+      slot = &k;
+      break;
+    }
+    if (!k.active && slot == nullptr) {
+      slot = &k;
+    }
+  }
+  if (slot == nullptr) {
+    return; // All slots taken by other controllers
+  }
+  slot->frame = frame;
+  slot->last_sent_ms = now;
+  slot->intent_ms = now;
+  slot->active = true;
 }
 
-float VESC_API::getFETTemp() {
-  return data.fet_temp;
+// Queue every setpoint whose period is up, drop those the app stopped
+// refreshing. Returns ms until the next one is due.
+uint32_t VESCMCP2515Bus::serviceKeepAlive() {
+  uint32_t wait_ms = CAN_POLL_MS;
+  if (keepalive_period_ms == 0) {
+    return wait_ms;
+  }
+  uint32_t now = millis();
+  
+  portENTER_CRITICAL(&txMux);
+  for (uint8_t i = 0; i < KEEPALIVE_SLOTS; i++) {
+    KeepAlive& k = keepalive[i];
+    if (!k.active) {
+      continue;
+    }
+    if (now - k.intent_ms >= keepalive_intent_ms) {
+      k.active = false; // App went quiet: let the VESC's own timeout stop the motor
+      continue;
+    }
+    uint32_t elapsed = now - k.last_sent_ms;
+    if (elapsed >= keepalive_period_ms) {
+      if ((tx_coalesce && coalesce(k.frame)) || txRing.push(k.frame)) {
+        keepalive_sent++;
+      }
+      k.last_sent_ms = now;
+      elapsed = 0;
+    }
+    if (keepalive_period_ms - elapsed < wait_ms) {
+      wait_ms = keepalive_period_ms - elapsed;
+    }
+  }
+  portEXIT_CRITICAL(&txMux);
+  return wait_ms;
 }
 
-float VESC_API::getMotorTemp() {
-  return data.motor_temp;
+bool VESCMCP2515Bus::isOneShot(const VESCFrame& frame) {
+  uint8_t cmd_id;
+  return isSetpoint(frame, &cmd_id) && (one_shot_commands & (1 << cmd_id));
 }
 
-float VESC_API::getAmpHours() {
-  return data.amp_hours;
+// Raw MCP2515 access
+uint8_t VESCMCP2515Bus::readRegister(uint8_t address) {
+  SPI.beginTransaction(SPISettings(MCP_SPI_HZ, MSBFIRST, SPI_MODE0));
+  digitalWrite(PIN_CS, LOW);
+  SPI.transfer(MCP2515_READ);
+  SPI.transfer(address);
+  uint8_t value = SPI.transfer(0x00);
+  digitalWrite(PIN_CS, HIGH);
+  SPI.endTransaction();
+  return value;
 }
 
-float VESC_API::getWattHours() {
-  return data.watt_hours;
+void VESCMCP2515Bus::modifyRegister(uint8_t address, uint8_t mask, uint8_t value) {
+  SPI.beginTransaction(SPISettings(MCP_SPI_HZ, MSBFIRST, SPI_MODE0));
+  digitalWrite(PIN_CS, LOW);
+  SPI.transfer(MCP2515_BIT_MODIFY);
+  SPI.transfer(address);
+  SPI.transfer(mask);
+  SPI.transfer(value);
+  digitalWrite(PIN_CS, HIGH);
+  SPI.endTransaction();
 }
 
-// System status functions
-bool VESC_API::isConnected() {
-  return data.data_valid && (millis() - data.last_update) < 1000;
+// RX and TX flags plus TXREQ of all buffers in one transfer
+uint8_t VESCMCP2515Bus::readStatus() {
+  SPI.beginTransaction(SPISettings(MCP_SPI_HZ, MSBFIRST, SPI_MODE0));
+  digitalWrite(PIN_CS, LOW);
+  SPI.transfer(MCP2515_READ_STATUS);
+  uint8_t status = SPI.transfer(0x00);
+  digitalWrite(PIN_CS, HIGH);
+  SPI.endTransaction();
+  return status;
 }
 
-unsigned long VESC_API::getLastUpdate() {
-  return data.last_update;
+// Header and data of RXBn in one burst; raising CS clears RXnIF
+void VESCMCP2515Bus::readRxBuffer(uint8_t n, VESCFrame& frame) {
+  uint8_t header[5];
+  
+  SPI.beginTransaction(SPISettings(MCP_SPI_HZ, MSBFIRST, SPI_MODE0));
+  digitalWrite(PIN_CS, LOW);
+  SPI.transfer(MCP2515_READ_RX | (n << 2));
+  for (uint8_t i = 0; i < 5; i++) {
+    header[i] = SPI.transfer(0x00);
+  }
+  frame.len = header[4] & 0x0F;
+  if (frame.len > 8) {
+    frame.len = 8;
+  }
+  for (uint8_t i = 0; i < frame.len; i++) {
+    frame.data[i] = SPI.transfer(0x00);
+  }
+  digitalWrite(PIN_CS, HIGH);
+  SPI.endTransaction();
+  
+  // SIDH, SIDL, EID8, EID0, DLC - same flag layout mcp_can returns
+  uint32_t sid = ((uint32_t)header[0] << 3) | (header[1] >> 5);
+  if (header[1] & 0x08) {
+    frame.id = CAN_ID_EXTENDED | (sid << 18) | ((uint32_t)(header[1] & 0x03) << 16) |
+               ((uint32_t)header[2] << 8) | header[3];
+    if (header[4] & 0x40) {
+      frame.id |= CAN_ID_REMOTE;
+    }
+  } else {
+    frame.id = sid;
+    if (header[1] & 0x10) {
+      frame.id |= CAN_ID_REMOTE;
+    }
+  }
 }
 
-// Command functions
-void VESC_API::setDutyCycle(float duty) {
-  // Clamp duty cycle to valid range (-100% to 100%)
-  duty = constrain(duty, -100.0f, 100.0f);
-  
-  // Convert to VESC format: duty cycle * 100000 (e.g., 10% = 10000)
-  int32_t duty_vesc = (int32_t)(duty * 100000.0f);
+// Load TXBn and request transmission at the given TXP (0-3, 3 highest)
+void VESCMCP2515Bus::loadTxBuffer(uint8_t n, const VESCFrame& frame, uint8_t priority) {
+  uint32_t id = frame.id & CAN_ID_MASK_EXT;
+  uint8_t header[5];
+  if (frame.id & CAN_ID_EXTENDED) {
+    header[0] = id >> 21;
+    header[1] = ((id >> 13) & 0xE0) | 0x08 | ((id >> 16) & 0x03);
+    header[2] = id >> 8;
+    header[3] = id;
+  } else {
+    header[0] = id >> 3;
+    header[1] = (id & 0x07) << 5;
+    header[2] = 0;
+    header[3] = 0;
+  }
+  uint8_t len = frame.len > 8 ? 8 : frame.len;
+  header[4] = len | ((frame.id & CAN_ID_REMOTE) ? 0x40 : 0);
   
-  uint8_t cmd_data[4];
-  cmd_data[0] = (duty_vesc >> 24) & 0xFF;
-  cmd_data[1] = (duty_vesc >> 16) & 0xFF;
-  cmd_data[2] = (duty_vesc >> 8) & 0xFF;
-  cmd_data[3] = duty_vesc & 0xFF;
+  SPI.beginTransaction(SPISettings(MCP_SPI_HZ, MSBFIRST, SPI_MODE0));
+  digitalWrite(PIN_CS, LOW);
+  SPI.transfer(MCP2515_LOAD_TX | (n << 1));
+  for (uint8_t i = 0; i < 5; i++) {
+    SPI.transfer(header[i]);
+  }
+  for (uint8_t i = 0; i < len; i++) {
+    SPI.transfer(frame.data[i]);
+  }
+  digitalWrite(PIN_CS, HIGH);
   
-  sendCommand(getCommandID(CMD_SET_DUTY), cmd_data, 4);
+  // TXREQ and TXP in one write
+  digitalWrite(PIN_CS, LOW);
+  SPI.transfer(MCP2515_WRITE);
+  SPI.transfer(MCP2515_TXB0CTRL + 0x10 * n);
+  SPI.transfer(TXB_TXREQ | priority);
+  digitalWrite(PIN_CS, HIGH);
+  SPI.endTransaction();
+}
+
+// Hardware filtering
+// Filters match the packet ID and ignore the controller ID, so status from
+// every VESC on the bus gets through. RXB0 (mask 0, filters 0-1) takes the
+// first two VESC_STATUS_PACKETS (STATUS_1 and STATUS_5) so the most important
+// frames get the higher priority buffer and can roll over into RXB1. RXB1
+// (mask 1, filters 2-5) takes the remaining status packets and the replies
+// to our long-buffer requests. Those are more than four, so mask 1 has to
+// ignore some packet ID bits: of all masks that fold them into four groups
+// it picks the one admitting the fewest packet IDs. The extra IDs this lets
+// through are dropped by the decoder.
+bool VESCMCP2515Bus::setHardwareFilter(bool enabled) {
+  if (canMutex != nullptr) {
+    xSemaphoreTake(canMutex, portMAX_DELAY);
+  }
+  bool ok = writeFilters(enabled);
+  if (canMutex != nullptr) {
+    xSemaphoreGive(canMutex);
+  }
+  return ok;
 }
 
-void VESC_API::setCurrent(float current) {
-  // Convert to VESC format (multiply by 1000)
-  int32_t current_vesc = (int32_t)(current * 1000.0f);
+// setHardwareFilter() without the lock
+bool VESCMCP2515Bus::writeFilters(bool enabled) {
+  const uint32_t PACKET_ID_MASK = 0x1FFFFF00;
+  const uint8_t rxb1_count = VESC_STATUS_PACKET_COUNT - 2 + VESC_REPLY_PACKET_COUNT;
+  uint8_t rxb1_packets[rxb1_count];
+  memcpy(rxb1_packets, VESC_STATUS_PACKETS + 2, VESC_STATUS_PACKET_COUNT - 2);
+  memcpy(rxb1_packets + VESC_STATUS_PACKET_COUNT - 2, VESC_REPLY_PACKETS, VESC_REPLY_PACKET_COUNT);
   
-  uint8_t cmd_data[4];
-  cmd_data[0] = (current_vesc >> 24) & 0xFF;
-  cmd_data[1] = (current_vesc >> 16) & 0xFF;
-  cmd_data[2] = (current_vesc >> 8) & 0xFF;
-  cmd_data[3] = current_vesc & 0xFF;
+  uint32_t filters[6] = {
+    (uint32_t)VESC_STATUS_PACKETS[0] << 8,
+    (uint32_t)VESC_STATUS_PACKETS[1] << 8
+  };
+  uint8_t best_mask = 0;
+  uint16_t best_admitted = 0xFFFF;
+  uint8_t best_groups[4] = {0, 0, 0, 0};
+  uint8_t best_count = 1;
   
-  sendCommand(getCommandID(CMD_SET_CURRENT), cmd_data, 4);
+  for (uint16_t mask = 0; mask <= 0xFF; mask++) {
+    uint8_t groups[4];
+    uint8_t count = 0;
+    for (uint8_t i = 0; i < rxb1_count && count <= 4; i++) {
+      uint8_t id = rxb1_packets[i] & mask;
+      bool seen = false;
+      for (uint8_t g = 0; g < count && g < 4; g++) {
+        seen = seen || groups[g] == id;
+      }
+      if (!seen) {
+        if (count < 4) {
+          groups[count] = id;
+        }
+        count++;
+      }
+    }
+    if (count > 4) {
+      continue;
+    }
+    
+    // Each group admits 2^(ignored bits) packet IDs
+    uint8_t ignored = 0;
+    for (uint8_t bit = 0; bit < 8; bit++) {
+      ignored += !(mask & (1 << bit));
+    }
+    uint16_t admitted = (uint16_t)count << ignored;
+    if (admitted < best_admitted) {
+      best_admitted = admitted;
+      best_mask = mask;
+      best_count = count;
+      memcpy(best_groups, groups, count);
+    }
+  }
+  
+  uint32_t mask1 = (PACKET_ID_MASK & 0x1FFF0000) | ((uint32_t)best_mask << 8);
+  for (uint8_t g = 0; g < 4; g++) {
+    // Unused filters repeat the last group
+    filters[2 + g] = (uint32_t)best_groups[g < best_count ? g : best_count - 1] << 8;
+  }
+  
+  // mcp_can switches to config mode and back around each write
+  bool ok = can.init_Mask(0, 1, enabled ? PACKET_ID_MASK : 0) == CAN_OK &&
+            can.init_Mask(1, 1, enabled ? mask1 : 0) == CAN_OK;
+  for (uint8_t i = 0; ok && i < 6; i++) {
+    ok = can.init_Filt(i, 1, enabled ? filters[i] : 0) == CAN_OK;
+  }
+  
+  hw_filter = ok && enabled;
+  return ok;
 }
 
-void VESC_API::setCurrentBrake(float current) {
-  // Convert to VESC format (multiply by 1000)
-  int32_t current_vesc = (int32_t)(current * 1000.0f);
-  
-  uint8_t cmd_data[4];
-  cmd_data[0] = (current_vesc >> 24) & 0xFF;
-  cmd_data[1] = (current_vesc >> 16) & 0xFF;
-  cmd_data[2] = (current_vesc >> 8) & 0xFF;
-  cmd_data[3] = current_vesc & 0xFF;
+bool VESCMCP2515Bus::isHardwareFilterEnabled() {
+  return hw_filter;
+}
+
+unsigned long VESCMCP2515Bus::getRxFrameCount() {
+  return rx_frames;
+}
+
+unsigned long VESCMCP2515Bus::getDroppedFrameCount() {
+  return rx_dropped;
+}
+
+// The MCP2515 flags an overflow, not how many frames it cost; each flag is
+// counted as one lost frame
+unsigned long VESCMCP2515Bus::getRxOverflowCount() {
+  return rx_overflow[RX_OVERFLOW_RXB0] + rx_overflow[RX_OVERFLOW_RXB1] + rx_dropped;
+}
+
+unsigned long VESCMCP2515Bus::getRxOverflowCount(VESCRxOverflow where) {
+  return where == RX_OVERFLOW_RING ? rx_dropped : rx_overflow[where];
+}
+
+void VESCMCP2515Bus::onRxOverflow(void (*callback)(VESCRxOverflow where)) {
+  rx_overflow_callback = callback;
+}
+
+uint16_t VESCMCP2515Bus::getTxQueued() {
+  return txRing.size() - tx_dead;
+}
+
+unsigned long VESCMCP2515Bus::getTxFrameCount() {
+  return tx_frames;
+}
+
+unsigned long VESCMCP2515Bus::getTxErrorCount() {
+  return tx_errors;
+}
+
+unsigned long VESCMCP2515Bus::getTxOverflowCount() {
+  return tx_overflow;
+}
+
+void VESCMCP2515Bus::setTxCoalescing(bool enabled) {
+  tx_coalesce = enabled;
+}
+
+unsigned long VESCMCP2515Bus::getTxCoalescedCount() {
+  unsigned long total = 0;
+  for (uint8_t i = 0; i <= CMD_SET_POS; i++) {
+    total += tx_coalesced[i];
+  }
+  return total;
+}
+
+unsigned long VESCMCP2515Bus::getTxCoalescedCount(VESCCommandID cmd_id) {
+  return cmd_id <= CMD_SET_POS ? tx_coalesced[cmd_id] : 0;
+}
+
+void VESCMCP2515Bus::setOneShot(bool enabled) {
+  one_shot_commands = enabled ? (1 << (CMD_SET_POS + 1)) - 1 : 0;
+}
+
+void VESCMCP2515Bus::setOneShot(VESCCommandID cmd_id, bool enabled) {
+  if (cmd_id > CMD_SET_POS) {
+    return;
+  }
+  if (enabled) {
+    one_shot_commands |= 1 << cmd_id;
+  } else {
+    one_shot_commands &= ~(1 << cmd_id);
+  }
+}
+
+unsigned long VESCMCP2515Bus::getOneShotSentCount() {
+  return one_shot_sent;
+}
+
+unsigned long VESCMCP2515Bus::getOneShotFailedCount() {
+  return one_shot_failed;
+}
+
+void VESCMCP2515Bus::setKeepAlive(uint32_t period_ms, uint32_t intent_timeout_ms) {
+  portENTER_CRITICAL(&txMux);
+  keepalive_period_ms = period_ms;
+  keepalive_intent_ms = intent_timeout_ms;
+  if (period_ms == 0) {
+    for (uint8_t i = 0; i < KEEPALIVE_SLOTS; i++) {
+      keepalive[i].active = false;
+    }
+  }
+  portEXIT_CRITICAL(&txMux);
   
-  sendCommand(getCommandID(CMD_SET_CURRENT_BRAKE), cmd_data, 4);
+  if (canTaskHandle != nullptr) {
+    xTaskNotify(canTaskHandle, NOTIFY_TX, eSetBits); // Pick up the new period right away
+  }
+}
+
+void VESCMCP2515Bus::releaseKeepAlive(uint8_t controller_id) {
+  portENTER_CRITICAL(&txMux);
+  for (uint8_t i = 0; i < KEEPALIVE_SLOTS; i++) {
+    if ((keepalive[i].frame.id & 0xFF) == controller_id) {
+      keepalive[i].active = false;
+    }
+  }
+  portEXIT_CRITICAL(&txMux);
+}
+
+unsigned long VESCMCP2515Bus::getKeepAliveSentCount() {
+  return keepalive_sent;
+}
+
+// Bus health
+VESCBusHealth VESCMCP2515Bus::getBusHealth() {
+  return health;
+}
+
+VESCBusState VESCMCP2515Bus::getBusState() {
+  return health.state;
+}
+
+void VESCMCP2515Bus::setBusOffRestart(uint32_t ms) {
+  bus_off_restart_ms = ms;
+}
+
+void VESCMCP2515Bus::onBusStateChange(void (*callback)(VESCBusState state)) {
+  bus_state_callback = callback;
 }
 
-void VESC_API::setBrake(float brake) {
-  // Convert percentage to current and call setCurrentBrake
-  setCurrentBrake(brake * 0.5f); // Simple conversion - adjust as needed
+// CAN task
+void VESCMCP2515Bus::setTask(UBaseType_t priority, uint32_t stack_bytes, BaseType_t core) {
+  task_priority = priority;
+  task_stack = stack_bytes;
+  task_core = core;
 }
 
-void VESC_API::setRPM(float rpm) {
-  int32_t rpm_vesc = (int32_t)rpm;
+void VESCMCP2515Bus::setReceiveHook(void (*hook)(void* ctx), void* ctx) {
+  rx_hook_ctx = ctx;
+  rx_hook = hook;
+}
+
+uint32_t VESCMCP2515Bus::getTaskStackFree() {
+  return canTaskHandle != nullptr ? uxTaskGetStackHighWaterMark(canTaskHandle) : 0;
+}
+
+// Constructor
+VESC_API::VESC_API() : VESCCore(mcp, arduinoClock), task_decode(false) {
+}
+
+// Initialize VESC CAN system
+bool VESC_API::init(size_t layout) {
+  Serial.println("Initializing VESC CAN system...");
+  
+  // VESC_MAX_NODES and friends size the node tables. #defined in the sketch
+  // rather than set as build flags, they give the sketch a different class
+  // layout than this file was compiled with, and every access would land
+  // in the wrong place.
+  if (layout != sizeof(VESC_API)) {
+    Serial.println("ERROR: VESC_* settings differ between sketch and library!");
+    Serial.println("Set them as build flags (build_opt.h), not with #define in the sketch");
+    return false;
+  }
   
-  uint8_t cmd_data[4];
-  cmd_data[0] = (rpm_vesc >> 24) & 0xFF;
-  cmd_data[1] = (rpm_vesc >> 16) & 0xFF;
-  cmd_data[2] = (rpm_vesc >> 8) & 0xFF;
-  cmd_data[3] = rpm_vesc & 0xFF;
+  if (!mcp.begin()) {
+    return false;
+  }
   
-  sendCommand(getCommandID(CMD_SET_RPM), cmd_data, 4);
+  Serial.println("VESC CAN system ready!");
+  return true;
+}
+
+// CAN service task
+void VESC_API::setServiceTask(bool decode, UBaseType_t priority, uint32_t stack_bytes, BaseType_t core) {
+  mcp.setTask(priority, stack_bytes, core);
+  mcp.setReceiveHook(decode ? decodeInTask : nullptr, this);
+  task_decode = decode;
+}
+
+bool VESC_API::isServiceTaskDecoding() {
+  return task_decode;
+}
+
+// Runs in the CAN task right after it drained the MCP2515, so telemetry and
+// snapshots are current however long loop() takes. The task wakes at least
+// every CAN_POLL_MS, which keeps background pings going on a quiet bus.
+void VESC_API::decodeInTask(void* ctx) {
+  static_cast<VESC_API*>(ctx)->VESCCore::update(0, 0);
+}
+
+// In decode mode the CAN task is the only consumer of the RX ring
+uint16_t VESC_API::update() {
+  return task_decode ? 0 : VESCCore::update();
+}
+
+uint16_t VESC_API::update(uint16_t max_frames, uint32_t max_micros) {
+  return task_decode ? 0 : VESCCore::update(max_frames, max_micros);
+}
+
+// Blocking requests (getValues()): give the CAN task a tick to fetch the
+// reply, then decode it here unless the task does that itself
+void VESC_API::waitForReply() {
+  vTaskDelay(1);
+  if (!task_decode) {
+    VESCCore::update(0, 0);
+  }
+}
+
+// Hardware filtering
+bool VESC_API::setHardwareFilter(bool enabled) {
+  return mcp.setHardwareFilter(enabled);
+}
+
+bool VESC_API::isHardwareFilterEnabled() {
+  return mcp.isHardwareFilterEnabled();
+}
+
+unsigned long VESC_API::getRxFrameCount() {
+  return mcp.getRxFrameCount();
+}
+
+// Bus health
+VESCBusHealth VESC_API::getBusHealth() {
+  return mcp.getBusHealth();
+}
+
+VESCBusState VESC_API::getBusState() {
+  return mcp.getBusState();
+}
+
+void VESC_API::setBusOffRestart(uint32_t ms) {
+  mcp.setBusOffRestart(ms);
+}
+
+void VESC_API::onBusStateChange(void (*callback)(VESCBusState state)) {
+  mcp.onBusStateChange(callback);
+}
+
+// Receive overflow
+unsigned long VESC_API::getRxOverflowCount() {
+  return mcp.getRxOverflowCount();
+}
+
+unsigned long VESC_API::getRxOverflowCount(VESCRxOverflow where) {
+  return mcp.getRxOverflowCount(where);
+}
+
+void VESC_API::onRxOverflow(void (*callback)(VESCRxOverflow where)) {
+  mcp.onRxOverflow(callback);
+}
+
+// Transmit statistics
+uint16_t VESC_API::getTxQueued() {
+  return mcp.getTxQueued();
+}
+
+unsigned long VESC_API::getTxFrameCount() {
+  return mcp.getTxFrameCount();
+}
+
+unsigned long VESC_API::getTxErrorCount() {
+  return mcp.getTxErrorCount();
+}
+
+// Command coalescing
+void VESC_API::setTxCoalescing(bool enabled) {
+  mcp.setTxCoalescing(enabled);
+}
+
+unsigned long VESC_API::getTxCoalescedCount() {
+  return mcp.getTxCoalescedCount();
+}
+
+// One-shot transmission
+void VESC_API::setOneShot(bool enabled) {
+  mcp.setOneShot(enabled);
+}
+
+void VESC_API::setOneShot(VESCCommandID cmd_id, bool enabled) {
+  mcp.setOneShot(cmd_id, enabled);
+}
+
+unsigned long VESC_API::getOneShotFailedCount() {
+  return mcp.getOneShotFailedCount();
+}
+
+// Command keep-alive
+void VESC_API::setKeepAlive(uint32_t period_ms, uint32_t intent_timeout_ms) {
+  mcp.setKeepAlive(period_ms, intent_timeout_ms);
+}
+
+// Zero current lets the motor coast, same as the VESC's own timeout
+void VESC_API::release(uint8_t controller_id) {
+  setCurrent(0.0f, controller_id);
+  mcp.releaseKeepAlive(controller_id);
 }
 
 // Display functions
 void VESC_API::printStatus() {
+  const VESCData& data = getData();
   unsigned long data_age = millis() - data.last_update;
   
   Serial.print(millis() / 1000.0, 1);
@@ -172,23 +1090,24 @@ void VESC_API::printStatus() {
   }
   
   Serial.print("Voltage: ");
-  Serial.print(data.input_voltage, 2);
+  Serial.print(getVoltage(), 2);
   Serial.print("V | RPM: ");
-  Serial.print((int)data.rpm);
+  Serial.print(getRPMInt());
   Serial.print(" | Duty: ");
-  Serial.print(data.duty_cycle * 100, 1);
+  Serial.print(getDuty(), 1);
   Serial.print("% | Motor Current: ");
-  Serial.print(data.motor_current, 2);
+  Serial.print(getMotorCurrent(), 2);
   Serial.print("A | Battery Current: ");
-  Serial.print(data.input_current, 2);
+  Serial.print(getBatteryCurrent(), 2);
   Serial.print("A | FET Temp: ");
-  Serial.print(data.fet_temp, 1);
+  Serial.print(getFETTemp(), 1);
   Serial.print("C | Amp Hours: ");
-  Serial.print(data.amp_hours, 3);
+  Serial.print(getAmpHours(), 3);
   Serial.println("Ah");
 }
 
 void VESC_API::printDebug() {
+  const VESCData& data = getData();
   Serial.println("=== VESC Debug Info ===");
   Serial.print("Connected: ");
   Serial.println(isConnected() ? "YES" : "NO");
@@ -197,102 +1116,120 @@ void VESC_API::printDebug() {
   Serial.print(" (");
   Serial.print(millis() - data.last_update);
   Serial.println("ms ago)");
+  Serial.println("Status  Age(ms)  Count  Mean(us)  Jitter  Min  Max  Missed  Outages");
+  static const VESCStatusMessage messages[6] = { STATUS_1, STATUS_2, STATUS_3, STATUS_4, STATUS_5, STATUS_6 };
+  for (uint8_t i = 0; i < 6; i++) {
+    uint32_t age = getAge(messages[i]);
+    const VESCMessageStats& st = getStats(messages[i]);
+    Serial.print("  S");
+    Serial.print(i + 1);
+    Serial.print("   ");
+    if (age == UINT32_MAX) {
+      Serial.println("-");
+      continue;
+    }
+    Serial.print(age / 1000);
+    Serial.print("  ");
+    Serial.print(st.count);
+    Serial.print("  ");
+    Serial.print(st.meanGap());
+    Serial.print("  ");
+    Serial.print(st.jitter());
+    Serial.print("  ");
+    Serial.print(st.gaps > 0 ? st.min_gap : 0);
+    Serial.print("  ");
+    Serial.print(st.max_gap);
+    Serial.print("  ");
+    Serial.print(st.missed);
+    Serial.print("  ");
+    Serial.println(st.outages);
+  }
   Serial.print("Message Count: ");
   Serial.println(data.message_count);
   Serial.print("Data Valid: ");
   Serial.println(data.data_valid ? "YES" : "NO");
-  Serial.println("========================");
-}
-
-// Internal helper functions
-bool VESC_API::parseVESCMessage(uint32_t id, uint8_t len, uint8_t* msg_data) {
-  if (!isStatusMessage(id)) {
-    return false;
+  Serial.print("RX Queued: ");
+  Serial.println(mcp.pending());
+  Serial.print("RX Dropped: ");
+  Serial.print(mcp.getDroppedFrameCount());
+  Serial.print(" (MCP2515 overflow: RXB0 ");
+  Serial.print(getRxOverflowCount(RX_OVERFLOW_RXB0));
+  Serial.print(", RXB1 ");
+  Serial.print(getRxOverflowCount(RX_OVERFLOW_RXB1));
+  Serial.println(")");
+  Serial.print("Nodes: ");
+  for (uint8_t i = 0; i < getNodeCount(); i++) {
+    Serial.print(getNodeID(i));
+    Serial.print(isConnected(getNodeID(i)) ? " " : "(lost) ");
   }
-  
-  switch (id) {
-    case STATUS_1: parseStatus1(msg_data); break;
-    case STATUS_2: parseStatus2(msg_data); break;
-    case STATUS_3: parseStatus3(msg_data); break;
-    case STATUS_4: parseStatus4(msg_data); break;
-    case STATUS_5: parseStatus5(msg_data); break;
-    case STATUS_6: parseStatus6(msg_data); break;
-    default: return false;
+  if (getRejectedNodeFrameCount() > 0) {
+    Serial.print("| frames from untracked nodes: ");
+    Serial.print(getRejectedNodeFrameCount());
   }
-  
-  data.last_update = millis();
-  data.data_valid = true;
-  data.message_count++;
-  return true;
-}
-
-void VESC_API::parseStatus1(uint8_t* msg_data) {
-  int32_t index = 0;
-  data.rpm = buffer_get_int32(msg_data, &index);
-  data.motor_current = buffer_get_int16(msg_data, &index) / 10.0f;
-  data.duty_cycle = buffer_get_int16(msg_data, &index) / 1000.0f;
-}
-
-void VESC_API::parseStatus2(uint8_t* msg_data) {
-  int32_t index = 0;
-  data.amp_hours = buffer_get_int32(msg_data, &index) / 10000.0f;
-  data.amp_hours_charged = buffer_get_int32(msg_data, &index) / 10000.0f;
-}
-
-void VESC_API::parseStatus3(uint8_t* msg_data) {
-  int32_t index = 0;
-  data.watt_hours = buffer_get_int32(msg_data, &index) / 10000.0f;
-  data.watt_hours_charged = buffer_get_int32(msg_data, &index) / 10000.0f;
-}
-
-void VESC_API::parseStatus4(uint8_t* msg_data) {
-  int32_t index = 0;
-  data.fet_temp = buffer_get_int16(msg_data, &index) / 10.0f;
-  data.motor_temp = buffer_get_int16(msg_data, &index) / 10.0f;
-  data.input_current = buffer_get_int16(msg_data, &index) / 10.0f;
-  data.pid_position = buffer_get_int16(msg_data, &index) / 50.0f;
-}
-
-void VESC_API::parseStatus5(uint8_t* msg_data) {
-  int32_t index = 0;
-  data.tacho_value = buffer_get_int32(msg_data, &index);
-  data.input_voltage = buffer_get_int16(msg_data, &index) / 10.0f;
-}
-
-void VESC_API::parseStatus6(uint8_t* msg_data) {
-  int32_t index = 0;
-  data.adc1 = buffer_get_int16(msg_data, &index) / 1000.0f;
-  data.adc2 = buffer_get_int16(msg_data, &index) / 1000.0f;
-  data.adc3 = buffer_get_int16(msg_data, &index) / 1000.0f;
-  data.ppm = buffer_get_int16(msg_data, &index) / 1000.0f;
-}
-
-bool VESC_API::isStatusMessage(uint32_t id) {
-  return (id == STATUS_1 || id == STATUS_2 || id == STATUS_3 || 
-          id == STATUS_4 || id == STATUS_5 || id == STATUS_6);
-}
-
-int32_t VESC_API::buffer_get_int32(const uint8_t* buffer, int32_t* index) {
-  int32_t res = ((uint32_t)buffer[*index]) << 24 |
-                ((uint32_t)buffer[*index + 1]) << 16 |
-                ((uint32_t)buffer[*index + 2]) << 8 |
-                ((uint32_t)buffer[*index + 3]);
-  *index += 4;
-  return res;
-}
-
-int16_t VESC_API::buffer_get_int16(const uint8_t* buffer, int32_t* index) {
-  int16_t res = ((uint16_t)buffer[*index]) << 8 |
-                ((uint16_t)buffer[*index + 1]);
-  *index += 2;
-  return res;
-}
-
-void VESC_API::sendCommand(uint32_t id, uint8_t* cmd_data, uint8_t len) {
-  can.sendMsgBuf(id, 1, len, cmd_data); // 1 = extended frame
+  Serial.println();
+  Serial.print("HW Filter: ");
+  Serial.println(isHardwareFilterEnabled() ? "ON" : "OFF");
+  Serial.print("RX Frames: ");
+  Serial.print(getRxFrameCount());
+  Serial.print(" (ignored: ");
+  Serial.print(getIgnoredFrameCount());
+  Serial.println(")");
+  Serial.print("TX Frames: ");
+  Serial.print(getTxFrameCount());
+  Serial.print(" (queued: ");
+  Serial.print(getTxQueued());
+  Serial.print(", errors: ");
+  Serial.print(getTxErrorCount());
+  Serial.print(", queue full: ");
+  Serial.print(mcp.getTxOverflowCount());
+  Serial.print(", coalesced: ");
+  Serial.print(getTxCoalescedCount());
+  Serial.println(")");
+  Serial.print("One-Shot: ");
+  Serial.print(mcp.getOneShotSentCount());
+  Serial.print(" sent, ");
+  Serial.print(getOneShotFailedCount());
+  Serial.println(" failed");
+  Serial.print("Requests: ");
+  Serial.print(getRequestTimeoutCount());
+  Serial.print(" timed out, ");
+  Serial.print(getBufferErrorCount());
+  Serial.println(" bad reply buffers");
+  const VESCLatencyHistogram& rtt = getPingStats();
+  if (rtt.count > 0) {
+    Serial.print("Ping RTT: p50 ");
+    Serial.print(rtt.p50());
+    Serial.print(" us, p99 ");
+    Serial.print(rtt.p99());
+    Serial.print(" us, max ");
+    Serial.print(rtt.max_us);
+    Serial.print(" us (");
+    Serial.print(getPingTimeoutCount());
+    Serial.println(" timed out)");
+  }
+  Serial.print("Keep-Alive Frames: ");
+  Serial.println(mcp.getKeepAliveSentCount());
+  static const char* const bus_states[] = { "ERROR ACTIVE", "WARNING", "ERROR PASSIVE", "BUS OFF" };
+  VESCBusHealth health = getBusHealth();
+  Serial.print("Bus: ");
+  Serial.print(bus_states[health.state]);
+  Serial.print(" (TEC ");
+  Serial.print(health.tec);
+  Serial.print(", REC ");
+  Serial.print(health.rec);
+  Serial.print(", errors ");
+  Serial.print(health.errors);
+  Serial.print(", passive ");
+  Serial.print(health.passives);
+  Serial.print("x, bus-off ");
+  Serial.print(health.bus_offs);
+  Serial.print("x, restarts ");
+  Serial.print(health.restarts);
+  Serial.println(")");
+  Serial.print("CAN Task: ");
+  Serial.print(task_decode ? "decoding" : "buffering");
+  Serial.print(", stack free ");
+  Serial.print(mcp.getTaskStackFree());
+  Serial.println(" bytes");
+  Serial.println("========================");
 }
-
-uint32_t VESC_API::getCommandID(VESCCommandID cmd_id) {
-  // VESC command format: (command_id << 8) | vesc_id
-  return ((uint32_t)cmd_id << 8) | VESC_ID;
-}
\ No newline at end of file
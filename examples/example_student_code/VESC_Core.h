@@ -0,0 +1,1902 @@
+#pragma once
+// Portable VESC CAN protocol core.
+//
+// Everything here is plain C++11 with no Arduino dependency: frame decoding,
+// command encoding, the node table and connection tracking. Hardware is
+// reached only through the VESCCanBus and VESCClock interfaces, so the same
+// code runs on the ESP32 (VESC_API.h) and builds with g++ on Linux.
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <atomic>
+
+// VESC Configuration
+constexpr uint8_t VESC_ID = 74;  // Default VESC ID (0x4A)
+constexpr uint32_t VESC_TIMEOUT_MS = 1000;  // No status for this long = disconnected
+constexpr uint32_t VESC_AGE_MAX = UINT32_MAX - 1;  // getAge() of a message older than micros() can measure
+
+// The settings below change the size of VESCCore, so they must be the same
+// in every file that includes this header: set them as build flags
+// (build_opt.h, build_flags), never with #define before the #include.
+
+// Number of controllers tracked at once (1-254). Each one costs three
+// VESCData (the node and two snapshot copies), about 340 bytes on the ESP32,
+// so raise it with -DVESC_MAX_NODES=n only for multi-motor vehicles.
+#ifndef VESC_MAX_NODES
+#define VESC_MAX_NODES 4
+#endif
+static_assert(VESC_MAX_NODES >= 1 && VESC_MAX_NODES <= 254, "VESC_MAX_NODES must be 1-254");
+
+// Nodes with reception statistics (getStats(), 288 bytes each): the first
+// VESC_STATS_NODES controllers heard from. Later ones are tracked without.
+#ifndef VESC_STATS_NODES
+#define VESC_STATS_NODES (VESC_MAX_NODES < 4 ? VESC_MAX_NODES : 4)
+#endif
+static_assert(VESC_STATS_NODES >= 1 && VESC_STATS_NODES <= VESC_MAX_NODES, "VESC_STATS_NODES must be 1-VESC_MAX_NODES");
+
+// Controllers with a ping round-trip histogram (304 bytes each), given out
+// to the first controllers ping() gets an answer from
+#ifndef VESC_PING_STATS_NODES
+#define VESC_PING_STATS_NODES 1
+#endif
+static_assert(VESC_PING_STATS_NODES >= 1 && VESC_PING_STATS_NODES <= 255, "VESC_PING_STATS_NODES must be 1-255");
+
+// Long-buffer transfers. Replies from the controllers are addressed to
+// VESC_HOST_ID, so it must not be the ID of any VESC on the bus; give each
+// host its own with -DVESC_HOST_ID=n when several share a bus.
+#ifndef VESC_HOST_ID
+#define VESC_HOST_ID 253
+#endif
+#ifndef VESC_RX_BUFFER_SIZE
+#define VESC_RX_BUFFER_SIZE 512  // Reassembly arena for long replies, bytes
+#endif
+static_assert(VESC_HOST_ID < 255, "VESC_HOST_ID 255 is the broadcast ID");
+constexpr uint32_t VESC_REQUEST_TIMEOUT_MS = 100;  // Default wait for a reply
+constexpr uint8_t VESC_PING_SLOTS = 8;  // Pings in flight at once, one per controller
+constexpr uint32_t VESC_DISCOVERY_MS = 500;      // Longest discover() may take
+constexpr uint32_t VESC_DISCOVERY_PING_MS = 10;  // Wait for each PONG during discovery
+
+// Default update() budget (0 = unlimited). update() drains everything queued
+// so a loop() that runs every 100-200 ms keeps up; set a budget with
+// setUpdateBudget() when loop() has deadlines of its own.
+constexpr uint16_t UPDATE_MAX_FRAMES = 0;    // Frames decoded per update() call
+constexpr uint32_t UPDATE_MAX_MICROS = 0;    // Time spent per update() call
+
+// VESC CAN Message IDs
+enum VESCStatusMessage {
+  STATUS_1 = 0x8000094A,  // RPM, Current, Duty
+  STATUS_2 = 0x80000E4A,  // Amp Hours
+  STATUS_3 = 0x80000F4A,  // Watt Hours
+  STATUS_4 = 0x8000104A,  // Temperatures, Current In
+  STATUS_5 = 0x80001B4A,  // Tacho, Voltage
+  STATUS_6 = 0x80001C4A   // ADC values
+};
+
+// VESC CAN packet IDs (bits 8-15 of the extended ID, bits 0-7 are the controller ID)
+enum VESCPacketID {
+  PACKET_STATUS_1 = 9,
+  PACKET_STATUS_2 = 14,
+  PACKET_STATUS_3 = 15,
+  PACKET_STATUS_4 = 16,
+  PACKET_STATUS_5 = 27,
+  PACKET_STATUS_6 = 28,     // As seen from our controllers (see STATUS_6)
+  PACKET_STATUS_6_ALT = 58, // CAN_PACKET_STATUS_6 in VESC firmware 5.3 and later
+  PACKET_FILL_RX_BUFFER = 5,        // Payload bytes at an 8-bit offset
+  PACKET_FILL_RX_BUFFER_LONG = 6,   // Payload bytes at a 16-bit offset
+  PACKET_PROCESS_RX_BUFFER = 7,     // Length and CRC: the filled buffer is complete
+  PACKET_PROCESS_SHORT_BUFFER = 8,  // Whole payload (up to 6 bytes) in one frame
+  PACKET_PING = 17,                 // data[0] = sender: the controller answers with PONG
+  PACKET_PONG = 18                  // data[0] = controller that was pinged
+};
+
+// Status packets in order of importance, for transports that filter by packet ID
+constexpr uint8_t VESC_STATUS_PACKETS[] = {
+  PACKET_STATUS_1, PACKET_STATUS_5, PACKET_STATUS_2, PACKET_STATUS_3,
+  PACKET_STATUS_4, PACKET_STATUS_6, PACKET_STATUS_6_ALT
+};
+constexpr uint8_t VESC_STATUS_PACKET_COUNT = sizeof(VESC_STATUS_PACKETS) / sizeof(VESC_STATUS_PACKETS[0]);
+
+// Packets controllers send to VESC_HOST_ID in reply to our requests
+constexpr uint8_t VESC_REPLY_PACKETS[] = {
+  PACKET_FILL_RX_BUFFER, PACKET_FILL_RX_BUFFER_LONG, PACKET_PROCESS_RX_BUFFER, PACKET_PROCESS_SHORT_BUFFER,
+  PACKET_PONG
+};
+constexpr uint8_t VESC_REPLY_PACKET_COUNT = sizeof(VESC_REPLY_PACKETS) / sizeof(VESC_REPLY_PACKETS[0]);
+
+// What the receiver of a buffer does with it (the send byte of PROCESS_*)
+constexpr uint8_t VESC_BUFFER_PROCESS = 0;          // Run the command and reply to the sender
+constexpr uint8_t VESC_BUFFER_REPLY = 1;            // A reply: hand it to the application
+constexpr uint8_t VESC_BUFFER_PROCESS_NO_REPLY = 2; // Run the command silently
+
+// Commands carried in buffers (COMM_PACKET_ID in the VESC firmware)
+enum VESCCommPacket {
+  COMM_GET_VALUES = 4,
+  COMM_GET_VALUES_SELECTIVE = 50  // Only the fields in a VESCValueField mask
+};
+
+// VESC Command IDs (as per VESC protocol)
+enum VESCCommandID {
+  CMD_SET_DUTY = 0,        // Set duty cycle
+  CMD_SET_CURRENT = 1,     // Set motor current
+  CMD_SET_CURRENT_BRAKE = 2, // Set brake current
+  CMD_SET_RPM = 3,         // Set RPM
+  CMD_SET_POS = 4          // Set position
+};
+
+// CAN ID flags (same layout in mcp_can and Linux SocketCAN)
+constexpr uint32_t CAN_ID_EXTENDED = 0x80000000;
+constexpr uint32_t CAN_ID_REMOTE   = 0x40000000;
+constexpr uint32_t CAN_ID_MASK_EXT = 0x1FFFFFFF;
+
+// Raw CAN frame
+struct VESCFrame {
+  uint32_t id;        // Bit 31 = extended, bit 30 = remote, bits 0-28 = CAN ID
+  uint8_t len;
+  uint8_t data[8];
+  uint32_t timestamp; // Receive time in VESCClock micros(), 0 if the transport has none
+};
+
+// VESC Data Structure
+// Values are kept exactly as they arrive on the wire (fixed-point integers,
+// scale noted per field). The getters convert on demand, so decoding a frame
+// never touches floating point - the ESP32-C3 has no FPU.
+struct VESCData {
+  // Motor data
+  int32_t rpm;                // ERPM
+  int16_t duty_cycle;         // Duty x 1000
+  int16_t motor_current;      // A x 10
+  int16_t input_current;      // A x 10
+  
+  // Power data
+  int16_t input_voltage;      // V x 10
+  int32_t amp_hours;          // Ah x 10000
+  int32_t amp_hours_charged;  // Ah x 10000
+  int32_t watt_hours;         // Wh x 10000
+  int32_t watt_hours_charged; // Wh x 10000
+  
+  // Temperature data
+  int16_t fet_temp;           // C x 10
+  int16_t motor_temp;         // C x 10
+  
+  // Position data
+  int16_t pid_position;       // Degrees x 50
+  int32_t tacho_value;
+  
+  // ADC inputs
+  int16_t adc1;               // V x 1000
+  int16_t adc2;               // V x 1000
+  int16_t adc3;               // V x 1000
+  int16_t ppm;                // -1.0 to 1.0 x 1000
+  
+  // System info
+  unsigned long last_update;  // millis() of the latest status frame of any kind
+  unsigned long message_count;
+  bool data_valid;
+  
+  // Per status message reception, index 0-5 = STATUS_1-6
+  uint32_t status_time[6];    // Receive time in micros()
+  uint32_t status_ms[6];      // Decode time in millis(), bounds ages past the micros() wrap
+  uint8_t status_seen;        // Bit per message received at least once
+};
+
+// Full telemetry from a COMM_GET_VALUES reply, in wire scale. fields has a
+// bit per VESCValueField the reply carried; older firmware stops early.
+struct VESCValues {
+  int16_t fet_temp;           // C x 10
+  int16_t motor_temp;         // C x 10
+  int32_t motor_current;      // A x 100
+  int32_t input_current;      // A x 100
+  int32_t id_current;         // A x 100
+  int32_t iq_current;         // A x 100
+  int16_t duty_cycle;         // Duty x 1000
+  int32_t rpm;                // ERPM
+  int16_t input_voltage;      // V x 10
+  int32_t amp_hours;          // Ah x 10000
+  int32_t amp_hours_charged;  // Ah x 10000
+  int32_t watt_hours;         // Wh x 10000
+  int32_t watt_hours_charged; // Wh x 10000
+  int32_t tacho_value;
+  int32_t tacho_abs;
+  uint8_t fault_code;         // mc_fault_code, 0 = none
+  int32_t pid_position;       // Degrees x 1000000
+  uint8_t controller_id;
+  int16_t mos_temp[3];        // C x 10, per FET
+  int32_t vd;                 // V x 1000
+  int32_t vq;                 // V x 1000
+  uint32_t fields;
+};
+
+// Fields of COMM_GET_VALUES in reply order
+enum VESCValueField : uint32_t {
+  VALUE_FET_TEMP = 1UL << 0,
+  VALUE_MOTOR_TEMP = 1UL << 1,
+  VALUE_MOTOR_CURRENT = 1UL << 2,
+  VALUE_INPUT_CURRENT = 1UL << 3,
+  VALUE_ID_CURRENT = 1UL << 4,
+  VALUE_IQ_CURRENT = 1UL << 5,
+  VALUE_DUTY = 1UL << 6,
+  VALUE_RPM = 1UL << 7,
+  VALUE_VOLTAGE = 1UL << 8,
+  VALUE_AMP_HOURS = 1UL << 9,
+  VALUE_AMP_HOURS_CHARGED = 1UL << 10,
+  VALUE_WATT_HOURS = 1UL << 11,
+  VALUE_WATT_HOURS_CHARGED = 1UL << 12,
+  VALUE_TACHO = 1UL << 13,
+  VALUE_TACHO_ABS = 1UL << 14,
+  VALUE_FAULT = 1UL << 15,
+  VALUE_PID_POSITION = 1UL << 16,
+  VALUE_CONTROLLER_ID = 1UL << 17,
+  VALUE_MOS_TEMPS = 1UL << 18,
+  VALUE_VD = 1UL << 19,
+  VALUE_VQ = 1UL << 20
+};
+constexpr uint8_t VESC_VALUE_FIELD_COUNT = 21;
+constexpr uint32_t VALUE_ALL = (1UL << VESC_VALUE_FIELD_COUNT) - 1;
+
+// Progress of the request in flight (one at a time: reply buffers carry no
+// sender until the final frame, so replies cannot be told apart earlier)
+enum VESCRequestState : uint8_t {
+  REQUEST_IDLE = 0,
+  REQUEST_PENDING = 1,    // Sent, waiting for the reply
+  REQUEST_DONE = 2,       // Reply received and decoded
+  REQUEST_TIMEOUT = 3,    // No reply in time
+  REQUEST_FAILED = 4      // Could not be queued for sending
+};
+
+// Reception statistics for one status message of one controller.
+// Gaps are measured between receive timestamps with integer Welford
+// updates; gaps of VESC_TIMEOUT_MS or more count as outages instead.
+struct VESCMessageStats {
+  uint32_t count;             // Frames received
+  uint32_t gaps;              // Inter-arrival samples in mean/variance
+  int32_t mean_q8;            // Mean gap in microseconds x 256
+  uint64_t m2;                // Sum of squared deviations from the mean, us^2
+  uint32_t min_gap;           // Shortest gap in microseconds
+  uint32_t max_gap;           // Longest gap in microseconds
+  uint32_t expected;          // Expected period in microseconds (set, or learned from regular gaps)
+  uint32_t missed;            // Frames estimated lost from gaps of 1.5 periods or more
+  uint16_t outages;           // Gaps too long to be missed frames (node gone, message disabled)
+  bool expected_fixed;        // expected came from setExpectedRate()
+  
+  uint32_t meanGap() const {
+    return (uint32_t)(mean_q8 >> 8);
+  }
+  
+  uint64_t variance() const {
+    return gaps > 1 ? m2 / (gaps - 1) : 0;
+  }
+  
+  // Standard deviation of the gap (jitter) in microseconds
+  uint32_t jitter() const {
+    uint64_t v = variance();
+    uint64_t root = 0;
+    for (uint64_t bit = (uint64_t)1 << 62; bit != 0; bit >>= 2) {
+      if (v >= root + bit) {
+        v -= root + bit;
+        root = (root >> 1) + bit;
+      } else {
+        root >>= 1;
+      }
+    }
+    return (uint32_t)root;
+  }
+};
+
+// Latency histogram in microseconds: exact below 8 us, then 8 buckets per
+// power of two (12.5% wide) up to about 1 s; longer samples land in the top
+// bucket. When a bucket would overflow all counts are halved, so old samples
+// fade out of the percentiles. min and max cover everything since reset.
+constexpr uint8_t LATENCY_BUCKETS = 144;
+
+struct VESCLatencyHistogram {
+  uint32_t count;             // Samples recorded
+  uint32_t min_us;
+  uint32_t max_us;
+  uint32_t last_us;
+  uint16_t buckets[LATENCY_BUCKETS];
+  
+  static uint8_t bucketOf(uint32_t us) {
+    if (us < 8) {
+      return (uint8_t)us;
+    }
+    uint8_t octave = 3;
+    while (octave < 31 && (us >> (octave + 1)) != 0) {
+      octave++;
+    }
+    if (octave > 19) {
+      return LATENCY_BUCKETS - 1;
+    }
+    return (octave - 2) * 8 + ((us >> (octave - 3)) & 7);
+  }
+  
+  // Lowest value that falls into bucket b
+  static uint32_t bucketLow(uint8_t b) {
+    return b < 8 ? b : (uint32_t)(8 + b % 8) << (b / 8 - 1);
+  }
+  
+  void record(uint32_t us) {
+    min_us = count == 0 || us < min_us ? us : min_us;
+    max_us = us > max_us ? us : max_us;
+    last_us = us;
+    count++;
+    uint8_t b = bucketOf(us);
+    if (buckets[b] == UINT16_MAX) {
+      for (uint8_t i = 0; i < LATENCY_BUCKETS; i++) {
+        buckets[i] >>= 1;
+      }
+    }
+    buckets[b]++;
+  }
+  
+  // Middle of the bucket holding the pct-th percentile, within [min, max];
+  // 0 if nothing was recorded
+  uint32_t percentile(uint8_t pct) const {
+    uint32_t total = 0;
+    for (uint8_t i = 0; i < LATENCY_BUCKETS; i++) {
+      total += buckets[i];
+    }
+    if (total == 0) {
+      return 0;
+    }
+    uint32_t rank = (total * pct + 99) / 100;
+    rank = rank == 0 ? 1 : rank;
+    uint32_t seen = 0;
+    uint8_t b = 0;
+    for (; b < LATENCY_BUCKETS - 1; b++) {
+      seen += buckets[b];
+      if (seen >= rank) {
+        break;
+      }
+    }
+    uint32_t width = b < 8 ? 1 : (uint32_t)1 << (b / 8 - 1);
+    uint32_t mid = bucketLow(b) + width / 2;
+    return mid < min_us ? min_us : (mid > max_us ? max_us : mid);
+  }
+  
+  uint32_t p50() const { return percentile(50); }
+  uint32_t p99() const { return percentile(99); }
+};
+
+// CAN controller error state (ISO 11898-1 fault confinement, plus the
+// warning level most controllers flag at 96 errors)
+enum VESCBusState : uint8_t {
+  BUS_ERROR_ACTIVE = 0,   // Normal operation
+  BUS_ERROR_WARNING = 1,  // TEC or REC at 96 or more: errors are piling up
+  BUS_ERROR_PASSIVE = 2,  // TEC or REC at 128 or more: no active error flags
+  BUS_OFF = 3             // TEC overflowed: the controller left the bus
+};
+
+constexpr uint8_t BUS_WARNING_LIMIT = 96;
+constexpr uint8_t BUS_PASSIVE_LIMIT = 128;
+
+// Error counter history of one CAN controller. The transport feeds it
+// readings of TEC, REC and the bus-off flag; update() tracks the state and
+// counts transitions into each worse state.
+struct VESCBusHealth {
+  VESCBusState state;
+  uint8_t tec;                // Transmit error counter, latest reading
+  uint8_t rec;                // Receive error counter, latest reading
+  uint8_t peak_tec;
+  uint8_t peak_rec;
+  uint32_t errors;            // Sum of counter increases seen between readings
+  uint16_t warnings;          // Entries into BUS_ERROR_WARNING or worse
+  uint16_t passives;          // Entries into BUS_ERROR_PASSIVE or worse
+  uint16_t bus_offs;          // Entries into BUS_OFF
+  uint16_t restarts;          // Bus-offs ended by the transport resetting the controller
+  uint32_t state_since_ms;    // millis() of the last state change
+  
+  static VESCBusState classify(uint8_t tec, uint8_t rec, bool bus_off) {
+    if (bus_off) {
+      return BUS_OFF;
+    }
+    uint8_t worst = tec > rec ? tec : rec;
+    if (worst >= BUS_PASSIVE_LIMIT) {
+      return BUS_ERROR_PASSIVE;
+    }
+    return worst >= BUS_WARNING_LIMIT ? BUS_ERROR_WARNING : BUS_ERROR_ACTIVE;
+  }
+  
+  // Feed one reading; true if the state changed
+  bool update(uint8_t new_tec, uint8_t new_rec, bool bus_off, uint32_t now_ms) {
+    // Counters only fall on success, so a rise is at least that many errors
+    // (a rise of 8 per transmit error, 1 or 8 per receive error)
+    errors += (new_tec > tec ? new_tec - tec : 0) + (new_rec > rec ? new_rec - rec : 0);
+    tec = new_tec;
+    rec = new_rec;
+    peak_tec = tec > peak_tec ? tec : peak_tec;
+    peak_rec = rec > peak_rec ? rec : peak_rec;
+    
+    VESCBusState next = classify(tec, rec, bus_off);
+    if (next == state) {
+      return false;
+    }
+    if (next > state) {
+      warnings += state < BUS_ERROR_WARNING;
+      passives += state < BUS_ERROR_PASSIVE && next >= BUS_ERROR_PASSIVE;
+      bus_offs += next == BUS_OFF;
+    }
+    state = next;
+    state_since_ms = now_ms;
+    return true;
+  }
+};
+
+// Buffer helpers (big-endian, same names and signatures as the VESC firmware)
+inline int32_t buffer_get_int32(const uint8_t* buffer, int32_t* index) {
+  int32_t res = ((uint32_t)buffer[*index]) << 24 |
+                ((uint32_t)buffer[*index + 1]) << 16 |
+                ((uint32_t)buffer[*index + 2]) << 8 |
+                ((uint32_t)buffer[*index + 3]);
+  *index += 4;
+  return res;
+}
+
+inline int16_t buffer_get_int16(const uint8_t* buffer, int32_t* index) {
+  int16_t res = ((uint16_t)buffer[*index]) << 8 |
+                ((uint16_t)buffer[*index + 1]);
+  *index += 2;
+  return res;
+}
+
+inline void buffer_append_int32(uint8_t* buffer, int32_t number, int32_t* index) {
+  buffer[(*index)++] = number >> 24;
+  buffer[(*index)++] = number >> 16;
+  buffer[(*index)++] = number >> 8;
+  buffer[(*index)++] = number;
+}
+
+inline void buffer_append_int16(uint8_t* buffer, int16_t number, int32_t* index) {
+  buffer[(*index)++] = number >> 8;
+  buffer[(*index)++] = number;
+}
+
+// CRC16-CCITT (polynomial 0x1021, initial value 0) over buffer transfers.
+// Table driven: one 256-entry table (512 bytes of flash) a byte at a time,
+// or with VESC_CRC16_SLICE4 three more tables (2 KB in all) and four bytes
+// per step. The tables are computed by the compiler, so they cost no RAM.
+#ifndef VESC_CRC16_SLICE4
+#define VESC_CRC16_SLICE4 1
+#endif
+
+// Reference implementation, one bit at a time
+inline uint16_t crc16_bitwise(uint16_t crc, const uint8_t* buf, uint32_t len) {
+  for (uint32_t i = 0; i < len; i++) {
+    crc ^= (uint16_t)buf[i] << 8;
+    for (uint8_t bit = 0; bit < 8; bit++) {
+      crc = (crc & 0x8000) ? (uint16_t)((crc << 1) ^ 0x1021) : (uint16_t)(crc << 1);
+    }
+  }
+  return crc;
+}
+
+// Table k holds the CRC of byte n followed by k zero bytes
+constexpr uint16_t crc16Bits(uint16_t crc, uint8_t bits) {
+  return bits == 0 ? crc : crc16Bits((crc & 0x8000) ? (uint16_t)((crc << 1) ^ 0x1021) : (uint16_t)(crc << 1), bits - 1);
+}
+
+constexpr uint16_t crc16Entry(uint8_t table, uint16_t n) {
+  return table == 0 ? crc16Bits((uint16_t)(n << 8), 8)
+                    : (uint16_t)((crc16Entry(table - 1, n) << 8) ^ crc16Entry(0, crc16Entry(table - 1, n) >> 8));
+}
+
+template <uint16_t... I> struct VESCCrcIndex {};
+template <uint16_t N, uint16_t... I> struct VESCCrcIndexGen : VESCCrcIndexGen<N - 1, N - 1, I...> {};
+template <uint16_t... I> struct VESCCrcIndexGen<0, I...> {
+  typedef VESCCrcIndex<I...> type;
+};
+
+template <typename Index> struct VESCCrcTables;
+template <uint16_t... I> struct VESCCrcTables<VESCCrcIndex<I...>> {
+  static constexpr uint16_t byte[256] = { crc16Entry(0, I)... };
+  static constexpr uint16_t slice[3][256] = {
+    { crc16Entry(1, I)... }, { crc16Entry(2, I)... }, { crc16Entry(3, I)... }
+  };
+};
+template <uint16_t... I> constexpr uint16_t VESCCrcTables<VESCCrcIndex<I...>>::byte[256];
+template <uint16_t... I> constexpr uint16_t VESCCrcTables<VESCCrcIndex<I...>>::slice[3][256];
+typedef VESCCrcTables<VESCCrcIndexGen<256>::type> VESCCrc;
+
+inline uint16_t crc16_bytewise(uint16_t crc, const uint8_t* buf, uint32_t len) {
+  for (uint32_t i = 0; i < len; i++) {
+    crc = (uint16_t)(crc << 8) ^ VESCCrc::byte[(uint8_t)(crc >> 8) ^ buf[i]];
+  }
+  return crc;
+}
+
+// The running CRC folds into the first two bytes; all four are then looked
+// up independently
+inline uint16_t crc16_slice4(uint16_t crc, const uint8_t* buf, uint32_t len) {
+  for (; len >= 4; len -= 4, buf += 4) {
+    crc = VESCCrc::slice[2][(uint8_t)(crc >> 8) ^ buf[0]] ^ VESCCrc::slice[1][(uint8_t)crc ^ buf[1]] ^
+          VESCCrc::slice[0][buf[2]] ^ VESCCrc::byte[buf[3]];
+  }
+  return crc16_bytewise(crc, buf, len);
+}
+
+// Continue a CRC over the next chunk: crc16_update(crc16_update(0, a, n), b, m)
+// equals the CRC of a and b back to back
+inline uint16_t crc16_update(uint16_t crc, const uint8_t* buf, uint32_t len) {
+#if VESC_CRC16_SLICE4
+  return crc16_slice4(crc, buf, len);
+#else
+  return crc16_bytewise(crc, buf, len);
+#endif
+}
+
+inline unsigned short crc16(const unsigned char* buf, unsigned int len) {
+  return crc16_update(0, buf, len);
+}
+
+// Lock-free single-producer/single-consumer frame ring.
+// Only the producer writes head, only the consumer writes tail.
+template <uint16_t SIZE>
+class VESCFrameRing {
+public:
+  VESCFrameRing() : head(0), tail(0) {}
+  
+  // Producer side, false if full
+  bool push(const VESCFrame& frame) {
+    uint16_t h = head.load(std::memory_order_relaxed);
+    if ((uint16_t)(h - tail.load(std::memory_order_acquire)) >= SIZE) {
+      return false;
+    }
+    frames[h & (SIZE - 1)] = frame;
+    head.store(h + 1, std::memory_order_release);
+    return true;
+  }
+  
+  // Consumer side, false if empty
+  bool pop(VESCFrame& frame) {
+    uint16_t t = tail.load(std::memory_order_relaxed);
+    if (t == head.load(std::memory_order_acquire)) {
+      return false;
+    }
+    frame = frames[t & (SIZE - 1)];
+    tail.store(t + 1, std::memory_order_release);
+    return true;
+  }
+  
+  uint16_t size() const {
+    return head.load(std::memory_order_acquire) - tail.load(std::memory_order_acquire);
+  }
+  
+  // i-th queued frame, 0 = oldest. Only safe while the consumer is locked out.
+  VESCFrame& peek(uint16_t i) {
+    return frames[(tail.load(std::memory_order_relaxed) + i) & (SIZE - 1)];
+  }
+
+private:
+  static_assert(SIZE != 0 && (SIZE & (SIZE - 1)) == 0, "Ring size must be a power of two");
+  
+  VESCFrame frames[SIZE];
+  std::atomic<uint16_t> head;
+  std::atomic<uint16_t> tail;
+};
+
+// Transport interface - implemented by the MCP2515 driver, SocketCAN, ...
+class VESCCanBus {
+public:
+  virtual ~VESCCanBus() {}
+  
+  virtual bool send(const VESCFrame& frame) = 0;  // Transmit or queue a frame, false on failure
+  virtual bool receive(VESCFrame& frame) = 0;     // Next received frame, false if none
+  virtual uint16_t pending() = 0;                 // Received frames not yet returned
+};
+
+// Time source interface
+class VESCClock {
+public:
+  virtual ~VESCClock() {}
+  
+  virtual uint32_t millis() = 0;
+  virtual uint32_t micros() = 0;
+};
+
+// Protocol core: decodes status frames into a node table and encodes commands
+class VESCCore {
+public:
+  VESCCore(VESCCanBus& bus, VESCClock& clock);
+  
+  // Data Reading Functions (for students)
+  // All readers and commands default to VESC_ID; pass another controller ID
+  // to talk to other VESCs on the same bus.
+  float getRPM(uint8_t controller_id = VESC_ID);
+  float getDuty(uint8_t controller_id = VESC_ID);            // Returns duty cycle as percentage (0-100)
+  float getMotorCurrent(uint8_t controller_id = VESC_ID);    // Returns motor current in Amps
+  float getBatteryCurrent(uint8_t controller_id = VESC_ID);  // Returns battery current in Amps
+  float getVoltage(uint8_t controller_id = VESC_ID);         // Returns input voltage in Volts
+  float getFETTemp(uint8_t controller_id = VESC_ID);         // Returns FET temperature in Celsius
+  float getMotorTemp(uint8_t controller_id = VESC_ID);       // Returns motor temperature in Celsius
+  float getAmpHours(uint8_t controller_id = VESC_ID);        // Returns consumed amp hours
+  float getWattHours(uint8_t controller_id = VESC_ID);       // Returns consumed watt hours
+  
+  // Integer Data Reading Functions (no floating point)
+  int32_t getRPMInt(uint8_t controller_id = VESC_ID);                  // Motor RPM
+  int16_t getDutyPermille(uint8_t controller_id = VESC_ID);            // Duty cycle in 0.1% steps (-1000 to 1000)
+  int32_t getMotorCurrentMilliAmps(uint8_t controller_id = VESC_ID);   // Motor current in mA
+  int32_t getBatteryCurrentMilliAmps(uint8_t controller_id = VESC_ID); // Battery current in mA
+  int32_t getVoltageMilliVolts(uint8_t controller_id = VESC_ID);       // Input voltage in mV
+  int16_t getFETTempDeciC(uint8_t controller_id = VESC_ID);            // FET temperature in 0.1 C steps
+  int16_t getMotorTempDeciC(uint8_t controller_id = VESC_ID);          // Motor temperature in 0.1 C steps
+  int32_t getMilliAmpHours(uint8_t controller_id = VESC_ID);           // Consumed mAh
+  int32_t getMilliWattHours(uint8_t controller_id = VESC_ID);          // Consumed mWh
+  
+  // Command Functions (for students)
+  void setDutyCycle(float duty, uint8_t controller_id = VESC_ID);    // Set duty cycle (-100 to 100)
+  void setCurrent(float current, uint8_t controller_id = VESC_ID);   // Set motor current in Amps
+  void setCurrentBrake(float current, uint8_t controller_id = VESC_ID); // Set brake current in Amps
+  void setBrake(float brake, uint8_t controller_id = VESC_ID);       // Set brake (0-100)
+  void setRPM(float rpm, uint8_t controller_id = VESC_ID);           // Set RPM
+  
+  // System Functions
+  uint16_t update();          // Call this in loop() to process CAN messages
+  uint16_t update(uint16_t max_frames, uint32_t max_micros); // Bounded update, returns frames handled
+  void setUpdateBudget(uint16_t max_frames, uint32_t max_micros); // Budget used by update()
+  bool hasPendingFrames();    // True if frames are still waiting to be decoded
+  bool isConnected(uint8_t controller_id = VESC_ID);         // Returns true if VESC is responding
+  bool isConnected(VESCStatusMessage msg, uint8_t controller_id = VESC_ID); // True if this message is fresh
+  unsigned long getLastUpdate(uint8_t controller_id = VESC_ID); // Returns time of last VESC message
+  uint32_t getAge(VESCStatusMessage msg, uint8_t controller_id = VESC_ID); // Microseconds since msg, UINT32_MAX if never
+  unsigned long getIgnoredFrameCount(); // Frames received but not VESC status
+  
+  // Multi-controller Functions
+  const VESCData& getData(uint8_t controller_id = VESC_ID);  // Raw telemetry of one controller
+  bool getSnapshot(VESCData& out, uint8_t controller_id = VESC_ID); // Frame-consistent copy, safe from any task
+  uint8_t getNodeCount();              // Controllers heard from so far
+  uint8_t getNodeID(uint8_t index);    // Controller ID of node 0 .. getNodeCount() - 1
+  unsigned long getRejectedNodeFrameCount(); // Frames from controllers beyond VESC_MAX_NODES
+  
+  // Reception Statistics
+  const VESCMessageStats& getStats(VESCStatusMessage msg, uint8_t controller_id = VESC_ID);
+  void setExpectedRate(VESCStatusMessage msg, uint16_t hz, uint8_t controller_id = VESC_ID); // 0 = learn it
+  void resetStats(uint8_t controller_id = VESC_ID);
+  
+  // Full Telemetry Requests (COMM_GET_VALUES over long buffers)
+  bool getValues(VESCValues& out, uint8_t controller_id = VESC_ID,
+                 uint32_t timeout_ms = VESC_REQUEST_TIMEOUT_MS); // Blocking: request and wait for the reply
+  bool requestValues(uint8_t controller_id = VESC_ID,
+                     uint32_t timeout_ms = VESC_REQUEST_TIMEOUT_MS); // Non-blocking, false if one is in flight
+  template <uint32_t Mask>
+  bool getValuesSelective(VESCValues& out, uint8_t controller_id = VESC_ID,
+                          uint32_t timeout_ms = VESC_REQUEST_TIMEOUT_MS); // Only the VESCValueField bits in Mask
+  template <uint32_t Mask>
+  bool requestValuesSelective(uint8_t controller_id = VESC_ID,
+                              uint32_t timeout_ms = VESC_REQUEST_TIMEOUT_MS);
+  VESCRequestState getRequestState();  // Poll after requestValues()
+  const VESCValues& getLastValues();   // Reply of the latest finished request
+  bool sendBuffer(uint8_t controller_id, const uint8_t* data, uint16_t len,
+                  uint8_t mode = VESC_BUFFER_PROCESS); // Any COMM_ packet, false if it could not all be queued
+  unsigned long getRequestTimeoutCount();
+  unsigned long getBufferErrorCount(); // Reply buffers dropped: bad CRC, length or offset
+  
+  // Round-Trip Probe (CAN_PACKET_PING, answered with PONG by the controller)
+  bool ping(uint32_t& rtt_us, uint8_t controller_id = VESC_ID,
+            uint32_t timeout_ms = VESC_REQUEST_TIMEOUT_MS); // Blocking, false on timeout
+  bool sendPing(uint8_t controller_id = VESC_ID,
+                uint32_t timeout_ms = VESC_REQUEST_TIMEOUT_MS); // Non-blocking, false if already in flight
+  void setPingInterval(uint32_t period_ms, uint8_t controller_id = VESC_ID); // Ping from update() (0 = off)
+  const VESCLatencyHistogram& getPingStats(uint8_t controller_id = VESC_ID); // Round trips in microseconds
+  void resetPingStats(uint8_t controller_id = VESC_ID);
+  unsigned long getPingTimeoutCount();
+  
+  // Node Discovery (pings every controller ID and listens for status frames)
+  uint8_t discover(uint8_t* ids, uint8_t max_ids,
+                   uint32_t timeout_ms = VESC_DISCOVERY_MS); // Blocking, returns IDs found (ascending)
+  
+  // Protocol Functions (transport independent, usable without a bus)
+  bool parseVESCMessage(const VESCFrame& frame);  // Decode one frame, false if not a status frame or reply
+  static void encodeCommand(VESCFrame& frame, VESCCommandID cmd_id, uint8_t controller_id, int32_t value);
+  static bool encodeBufferFrame(VESCFrame& frame, uint16_t n, uint8_t controller_id, uint8_t sender_id,
+                                const uint8_t* data, uint16_t len, uint8_t mode); // Frame n of a transfer
+  static uint16_t decodeValues(VESCValues& out, const uint8_t* data, uint16_t len, uint32_t mask); // Bytes used
+
+protected:
+  VESCCanBus& bus;
+  VESCClock& clock;
+  
+  // How a blocking request lets the reply in; the default decodes in place
+  virtual void waitForReply();
+
+private:
+  // Node table: one VESCData per controller, found through node_slot in O(1)
+  VESCData nodes[VESC_MAX_NODES];
+  uint8_t node_ids[VESC_MAX_NODES];
+  uint8_t node_slot[256];         // Controller ID -> node index + 1, 0 = not tracked
+  uint8_t node_count;
+  unsigned long nodes_rejected;
+  unsigned long rx_ignored;
+  VESCMessageStats stats[VESC_STATS_NODES][6]; // Per node, per STATUS_1-6
+  
+  // Snapshots for other tasks: two copies behind a sequence counter. While
+  // one copy is rewritten the counter points readers at the other, so a
+  // reader never waits on a preempted writer.
+  VESCData snapshots[2][VESC_MAX_NODES];
+  std::atomic<uint32_t> snapshot_seq[VESC_MAX_NODES];
+  
+  // update() budget
+  uint16_t update_max_frames;
+  uint32_t update_max_micros;
+  
+  // Long-buffer request in flight. The requester fills in the fields, then
+  // publishes with request_state; whoever decodes the reply finishes it.
+  std::atomic<uint8_t> request_state;
+  uint8_t request_controller;
+  uint8_t request_command;
+  uint32_t request_sent_ms;
+  uint32_t request_timeout_ms;
+  VESCValues values;
+  uint8_t rx_buffer[VESC_RX_BUFFER_SIZE];  // Reply reassembly
+  uint16_t rx_crc;                // CRC of rx_buffer[0 .. rx_crc_len), kept up as frames arrive
+  uint16_t rx_crc_len;            // UINT16_MAX once a frame arrived out of order
+  unsigned long request_timeouts;
+  unsigned long buffer_errors;
+  
+  // Pings in flight. A slot is claimed, filled in, then published as
+  // PING_PENDING before the frame goes out; the PONG handler finishes it.
+  enum PingState : uint8_t {
+    PING_FREE = 0,
+    PING_CLAIMED = 1,   // Being filled in by the sender
+    PING_PENDING = 2,
+    PING_ANSWERED = 3,  // rtt_us is valid; free for reuse
+    PING_ANSWERING = 4  // PONG handler won the slot and is writing rtt_us
+  };
+  struct PingSlot {
+    std::atomic<uint8_t> state;
+    uint8_t controller_id;
+    uint32_t sent_us;
+    uint32_t sent_ms;
+    uint32_t timeout_ms;
+    uint32_t rtt_us;
+    bool probe;         // Discovery ping: a timeout is the expected outcome
+  };
+  PingSlot ping_slots[VESC_PING_SLOTS];
+  VESCLatencyHistogram ping_stats[VESC_PING_STATS_NODES];
+  uint8_t ping_stats_ids[VESC_PING_STATS_NODES];
+  uint8_t ping_stats_count;
+  uint32_t ping_period_ms;        // setPingInterval(), 0 = off
+  uint8_t ping_target;
+  uint32_t ping_last_ms;
+  unsigned long ping_timeouts;
+  
+  // Controller IDs heard from while discover() runs, a bit per ID
+  std::atomic<bool> discovering;
+  std::atomic<uint8_t> discovered[32];   // Set by the decoding task, read by discover()
+  
+  VESCData* findNode(uint8_t controller_id);
+  VESCData* addNode(uint8_t controller_id);
+  
+  // Status decoders
+  static void parseStatus1(VESCData& d, const uint8_t* msg_data);
+  static void parseStatus2(VESCData& d, const uint8_t* msg_data);
+  static void parseStatus3(VESCData& d, const uint8_t* msg_data);
+  static void parseStatus4(VESCData& d, const uint8_t* msg_data);
+  static void parseStatus5(VESCData& d, const uint8_t* msg_data);
+  static void parseStatus6(VESCData& d, const uint8_t* msg_data);
+  
+  // Status dispatch table, indexed by CAN packet ID
+  struct StatusHandler {
+    void (*decode)(VESCData& d, const uint8_t* msg_data);
+    uint8_t min_len;
+    uint8_t slot;               // Index into VESCData::status_time
+  };
+  static const StatusHandler* statusHandlers();
+  static const VESCData& noData();
+  static void recordArrival(VESCMessageStats& st, uint32_t gap);
+  void publishSnapshot(uint8_t index);
+  
+  // Long buffers
+  bool parseBufferFrame(uint8_t packet_id, const VESCFrame& frame);
+  void handleReply(uint8_t sender_id, const uint8_t* data, uint16_t len);
+  bool startRequest(uint8_t controller_id, const uint8_t* data, uint16_t len, uint32_t timeout_ms);
+  bool startSelectiveRequest(uint32_t mask, uint8_t controller_id, uint32_t timeout_ms);
+  bool finishRequest(VESCValues& out);
+  void applyValues(uint8_t controller_id, const VESCValues& v);
+  
+  // Round-trip probe
+  int8_t startPing(uint8_t controller_id, uint32_t timeout_ms, bool probe = false); // Slot used, -1 if none
+  bool parsePong(const VESCFrame& frame);
+  VESCLatencyHistogram* findPingStats(uint8_t controller_id, bool add);
+  void expirePings();
+  void servicePing();
+  void markDiscovered(uint8_t controller_id);
+  bool isDiscovered(uint8_t controller_id);
+  
+  // Command sending
+  void sendCommand(VESCCommandID cmd_id, uint8_t controller_id, int32_t value);
+};
+
+// ============================================================================
+// Implementation
+// ============================================================================
+
+inline VESCCore::VESCCore(VESCCanBus& bus, VESCClock& clock)
+  : bus(bus), clock(clock), node_count(0), nodes_rejected(0), rx_ignored(0),
+    update_max_frames(UPDATE_MAX_FRAMES), update_max_micros(UPDATE_MAX_MICROS),
+    request_state(REQUEST_IDLE), request_controller(0), request_command(0), request_sent_ms(0),
+    request_timeout_ms(0), rx_crc(0), rx_crc_len(0), request_timeouts(0), buffer_errors(0),
+    ping_stats_count(0), ping_period_ms(0), ping_target(VESC_ID), ping_last_ms(0), ping_timeouts(0), discovering(false) {
+  memset(nodes, 0, sizeof(nodes));
+  memset(&values, 0, sizeof(values));
+  memset(node_ids, 0, sizeof(node_ids));
+  memset(node_slot, 0, sizeof(node_slot));
+  memset(snapshots, 0, sizeof(snapshots));
+  for (uint8_t i = 0; i < VESC_MAX_NODES; i++) {
+    snapshot_seq[i].store(0, std::memory_order_relaxed);
+  }
+  memset(ping_stats, 0, sizeof(ping_stats));
+  for (uint8_t i = 0; i < 32; i++) {
+    discovered[i].store(0, std::memory_order_relaxed);
+  }
+  for (uint8_t i = 0; i < VESC_PING_SLOTS; i++) {
+    ping_slots[i].state.store(PING_FREE, std::memory_order_relaxed);
+  }
+  memset(ping_stats_ids, 0, sizeof(ping_stats_ids));
+  memset(stats, 0, sizeof(stats));
+  for (uint8_t i = 0; i < VESC_STATS_NODES; i++) {
+    for (uint8_t m = 0; m < 6; m++) {
+      stats[i][m].min_gap = UINT32_MAX;
+    }
+  }
+}
+
+// Student-friendly data reading functions
+inline float VESCCore::getRPM(uint8_t controller_id) {
+  return (float)getData(controller_id).rpm;
+}
+
+inline float VESCCore::getDuty(uint8_t controller_id) {
+  return getData(controller_id).duty_cycle / 10.0f; // Duty x 1000 to percentage
+}
+
+inline float VESCCore::getMotorCurrent(uint8_t controller_id) {
+  return getData(controller_id).motor_current / 10.0f;
+}
+
+inline float VESCCore::getBatteryCurrent(uint8_t controller_id) {
+  return getData(controller_id).input_current / 10.0f;
+}
+
+inline float VESCCore::getVoltage(uint8_t controller_id) {
+  return getData(controller_id).input_voltage / 10.0f;
+}
+
+inline float VESCCore::getFETTemp(uint8_t controller_id) {
+  return getData(controller_id).fet_temp / 10.0f;
+}
+
+inline float VESCCore::getMotorTemp(uint8_t controller_id) {
+  return getData(controller_id).motor_temp / 10.0f;
+}
+
+inline float VESCCore::getAmpHours(uint8_t controller_id) {
+  return getData(controller_id).amp_hours / 10000.0f;
+}
+
+inline float VESCCore::getWattHours(uint8_t controller_id) {
+  return getData(controller_id).watt_hours / 10000.0f;
+}
+
+// Integer data reading functions
+inline int32_t VESCCore::getRPMInt(uint8_t controller_id) {
+  return getData(controller_id).rpm;
+}
+
+inline int16_t VESCCore::getDutyPermille(uint8_t controller_id) {
+  return getData(controller_id).duty_cycle;
+}
+
+inline int32_t VESCCore::getMotorCurrentMilliAmps(uint8_t controller_id) {
+  return (int32_t)getData(controller_id).motor_current * 100;
+}
+
+inline int32_t VESCCore::getBatteryCurrentMilliAmps(uint8_t controller_id) {
+  return (int32_t)getData(controller_id).input_current * 100;
+}
+
+inline int32_t VESCCore::getVoltageMilliVolts(uint8_t controller_id) {
+  return (int32_t)getData(controller_id).input_voltage * 100;
+}
+
+inline int16_t VESCCore::getFETTempDeciC(uint8_t controller_id) {
+  return getData(controller_id).fet_temp;
+}
+
+inline int16_t VESCCore::getMotorTempDeciC(uint8_t controller_id) {
+  return getData(controller_id).motor_temp;
+}
+
+inline int32_t VESCCore::getMilliAmpHours(uint8_t controller_id) {
+  return getData(controller_id).amp_hours / 10;
+}
+
+inline int32_t VESCCore::getMilliWattHours(uint8_t controller_id) {
+  return getData(controller_id).watt_hours / 10;
+}
+
+// Command functions
+inline void VESCCore::setDutyCycle(float duty, uint8_t controller_id) {
+  // Clamp duty cycle to valid range (-100% to 100%)
+  duty = duty < -100.0f ? -100.0f : (duty > 100.0f ? 100.0f : duty);
+  
+  // Convert to VESC format: duty cycle * 100000 (e.g., 10% = 10000)
+  sendCommand(CMD_SET_DUTY, controller_id, (int32_t)(duty * 100000.0f));
+}
+
+inline void VESCCore::setCurrent(float current, uint8_t controller_id) {
+  // Convert to VESC format (multiply by 1000)
+  sendCommand(CMD_SET_CURRENT, controller_id, (int32_t)(current * 1000.0f));
+}
+
+inline void VESCCore::setCurrentBrake(float current, uint8_t controller_id) {
+  // Convert to VESC format (multiply by 1000)
+  sendCommand(CMD_SET_CURRENT_BRAKE, controller_id, (int32_t)(current * 1000.0f));
+}
+
+inline void VESCCore::setBrake(float brake, uint8_t controller_id) {
+  // Convert percentage to current and call setCurrentBrake
+  setCurrentBrake(brake * 0.5f, controller_id); // Simple conversion - adjust as needed
+}
+
+inline void VESCCore::setRPM(float rpm, uint8_t controller_id) {
+  sendCommand(CMD_SET_RPM, controller_id, (int32_t)rpm);
+}
+
+// Update function - call this in loop()
+inline uint16_t VESCCore::update() {
+  return update(update_max_frames, update_max_micros);
+}
+
+// Decode received frames until the bus has none left or the budget is spent.
+// Frames left over stay queued in the transport for the next call.
+inline uint16_t VESCCore::update(uint16_t max_frames, uint32_t max_micros) {
+  uint32_t start = clock.micros();
+  uint16_t handled = 0;
+  VESCFrame frame;
+  
+  if (ping_period_ms != 0) {
+    servicePing();
+  }
+  while ((max_frames == 0 || handled < max_frames) && bus.receive(frame)) {
+    if (!parseVESCMessage(frame)) {
+      rx_ignored++;
+    }
+    handled++;
+    
+    if (max_micros != 0 && clock.micros() - start >= max_micros) {
+      break;
+    }
+  }
+  return handled;
+}
+
+inline void VESCCore::setUpdateBudget(uint16_t max_frames, uint32_t max_micros) {
+  update_max_frames = max_frames;
+  update_max_micros = max_micros;
+}
+
+inline bool VESCCore::hasPendingFrames() {
+  return bus.pending() > 0;
+}
+
+// System status functions
+inline bool VESCCore::isConnected(uint8_t controller_id) {
+  const VESCData& data = getData(controller_id);
+  return data.data_valid && (clock.millis() - data.last_update) < VESC_TIMEOUT_MS;
+}
+
+inline bool VESCCore::isConnected(VESCStatusMessage msg, uint8_t controller_id) {
+  return getAge(msg, controller_id) < VESC_TIMEOUT_MS * 1000;
+}
+
+inline unsigned long VESCCore::getLastUpdate(uint8_t controller_id) {
+  return getData(controller_id).last_update;
+}
+
+// Measured from the frame's receive timestamp, not from when update() ran.
+// micros() wraps after 71.6 minutes, so older messages report
+// VESC_AGE_MAX instead of an age that has wrapped back to small values.
+inline uint32_t VESCCore::getAge(VESCStatusMessage msg, uint8_t controller_id) {
+  const StatusHandler& handler = statusHandlers()[((uint32_t)msg >> 8) & 0xFF];
+  const VESCData& data = getData(controller_id);
+  if (handler.decode == nullptr || !(data.status_seen & (1 << handler.slot))) {
+    return UINT32_MAX;
+  }
+  if (clock.millis() - data.status_ms[handler.slot] >= VESC_AGE_MAX / 1000 - 1000) {
+    return VESC_AGE_MAX;
+  }
+  uint32_t age = clock.micros() - data.status_time[handler.slot];
+  return age < VESC_AGE_MAX ? age : VESC_AGE_MAX;
+}
+
+inline unsigned long VESCCore::getIgnoredFrameCount() {
+  return rx_ignored;
+}
+
+// Multi-controller functions
+inline const VESCData& VESCCore::getData(uint8_t controller_id) {
+  const VESCData* node = findNode(controller_id);
+  return node != nullptr ? *node : noData();
+}
+
+// Reader side of the snapshot latch: copy whichever version the counter
+// selects, retry if the writer moved on meanwhile
+inline bool VESCCore::getSnapshot(VESCData& out, uint8_t controller_id) {
+  uint8_t slot = node_slot[controller_id];
+  if (slot == 0) {
+    out = noData();
+    return false;
+  }
+  std::atomic<uint32_t>& seq = snapshot_seq[slot - 1];
+  uint32_t start;
+  do {
+    start = seq.load(std::memory_order_acquire);
+    memcpy(&out, &snapshots[start & 1][slot - 1], sizeof(out));
+    std::atomic_thread_fence(std::memory_order_acquire);
+  } while (seq.load(std::memory_order_relaxed) != start);
+  return out.data_valid;
+}
+
+// Writer side: odd counter sends readers to copy 1 while copy 0 is
+// written, even sends them back while copy 1 catches up
+inline void VESCCore::publishSnapshot(uint8_t index) {
+  std::atomic<uint32_t>& seq = snapshot_seq[index];
+  uint32_t start = seq.load(std::memory_order_relaxed);
+  
+  seq.store(start + 1, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_release);
+  memcpy(&snapshots[0][index], &nodes[index], sizeof(VESCData));
+  
+  seq.store(start + 2, std::memory_order_release);
+  std::atomic_thread_fence(std::memory_order_release);
+  memcpy(&snapshots[1][index], &nodes[index], sizeof(VESCData));
+}
+
+inline uint8_t VESCCore::getNodeCount() {
+  return node_count;
+}
+
+inline uint8_t VESCCore::getNodeID(uint8_t index) {
+  return index < node_count ? node_ids[index] : 0;
+}
+
+inline unsigned long VESCCore::getRejectedNodeFrameCount() {
+  return nodes_rejected;
+}
+
+// Reception statistics
+inline const VESCMessageStats& VESCCore::getStats(VESCStatusMessage msg, uint8_t controller_id) {
+  static const VESCMessageStats none = {0, 0, 0, 0, UINT32_MAX, 0, 0, 0, 0, false};
+  const StatusHandler& handler = statusHandlers()[((uint32_t)msg >> 8) & 0xFF];
+  uint8_t slot = node_slot[controller_id];
+  if (handler.decode == nullptr || slot == 0 || slot > VESC_STATS_NODES) {
+    return none;
+  }
+  return stats[slot - 1][handler.slot];
+}
+
+// The VESC's status rates are configured in VESC Tool; telling us makes the
+// missed-frame estimate exact instead of learned
+inline void VESCCore::setExpectedRate(VESCStatusMessage msg, uint16_t hz, uint8_t controller_id) {
+  const StatusHandler& handler = statusHandlers()[((uint32_t)msg >> 8) & 0xFF];
+  VESCData* node = findNode(controller_id);
+  if (node == nullptr) {
+    node = addNode(controller_id);
+  }
+  if (handler.decode == nullptr || node == nullptr || node - nodes >= VESC_STATS_NODES) {
+    return;
+  }
+  VESCMessageStats& st = stats[node - nodes][handler.slot];
+  st.expected = hz != 0 ? 1000000UL / hz : 0;
+  st.expected_fixed = hz != 0;
+}
+
+inline void VESCCore::resetStats(uint8_t controller_id) {
+  VESCData* node = findNode(controller_id);
+  if (node == nullptr || node - nodes >= VESC_STATS_NODES) {
+    return;
+  }
+  for (uint8_t m = 0; m < 6; m++) {
+    VESCMessageStats& st = stats[node - nodes][m];
+    uint32_t expected = st.expected_fixed ? st.expected : 0;
+    bool fixed = st.expected_fixed;
+    memset(&st, 0, sizeof(st));
+    st.min_gap = UINT32_MAX;
+    st.expected = expected;
+    st.expected_fixed = fixed;
+  }
+}
+
+// One more frame, gap microseconds after the previous one (0 = first frame)
+inline void VESCCore::recordArrival(VESCMessageStats& st, uint32_t gap) {
+  st.count++;
+  if (st.count == 1) {
+    return;
+  }
+  if (gap >= VESC_TIMEOUT_MS * 1000) {
+    st.outages++;
+    return;
+  }
+  
+  // Welford in Q8 fixed point; gaps below 1 s keep the product within 64 bits
+  st.gaps++;
+  int32_t x = (int32_t)(gap << 8);
+  int32_t delta = x - st.mean_q8;
+  st.mean_q8 += delta / (int32_t)st.gaps;
+  st.m2 += (uint64_t)((int64_t)delta * (x - st.mean_q8)) >> 16;
+  st.min_gap = gap < st.min_gap ? gap : st.min_gap;
+  st.max_gap = gap > st.max_gap ? gap : st.max_gap;
+  
+  // A gap of 1.5 periods or more means frames went missing; shorter ones
+  // refine the learned period (moving average, 1/8 weight)
+  if (st.expected == 0) {
+    st.expected = gap;
+  } else if (gap * 2 >= st.expected * 3) {
+    st.missed += (gap + st.expected / 2) / st.expected - 1;
+  } else if (!st.expected_fixed) {
+    st.expected += ((int32_t)gap - (int32_t)st.expected) / 8;
+  }
+}
+
+inline VESCData* VESCCore::findNode(uint8_t controller_id) {
+  uint8_t slot = node_slot[controller_id];
+  return slot != 0 ? &nodes[slot - 1] : nullptr;
+}
+
+// Nodes are added the first time a controller is heard and never removed
+inline VESCData* VESCCore::addNode(uint8_t controller_id) {
+  if (node_count >= VESC_MAX_NODES || controller_id == 0xFF) {
+    return nullptr; // Table full, or the broadcast ID
+  }
+  node_ids[node_count] = controller_id;
+  node_count++;
+  node_slot[controller_id] = node_count;
+  return &nodes[node_count - 1];
+}
+
+// All-zero telemetry for controllers we have not heard from
+inline const VESCData& VESCCore::noData() {
+  static const VESCData empty = {};
+  return empty;
+}
+
+// Status decoders indexed by CAN packet ID. The table is constant-initialized,
+// so it sits in flash and dispatch is a single indexed load. Unused packet
+// IDs (including 0x40-0xFF, left to zero-initialization) have no decoder.
+inline const VESCCore::StatusHandler* VESCCore::statusHandlers() {
+  static const StatusHandler table[256] = {
+    // 0x00 - 0x0F
+    {nullptr, 0, 0}, {nullptr, 0, 0}, {nullptr, 0, 0}, {nullptr, 0, 0},
+    {nullptr, 0, 0}, {nullptr, 0, 0}, {nullptr, 0, 0}, {nullptr, 0, 0},
+    {nullptr, 0, 0}, {parseStatus1, 8, 0}, {nullptr, 0, 0}, {nullptr, 0, 0},
+    {nullptr, 0, 0}, {nullptr, 0, 0}, {parseStatus2, 8, 1}, {parseStatus3, 8, 2},
+    // 0x10 - 0x1F
+    {parseStatus4, 8, 3}, {nullptr, 0, 0}, {nullptr, 0, 0}, {nullptr, 0, 0},
+    {nullptr, 0, 0}, {nullptr, 0, 0}, {nullptr, 0, 0}, {nullptr, 0, 0},
+    {nullptr, 0, 0}, {nullptr, 0, 0}, {nullptr, 0, 0}, {parseStatus5, 6, 4},
+    {parseStatus6, 8, 5}, {nullptr, 0, 0}, {nullptr, 0, 0}, {nullptr, 0, 0},
+    // 0x20 - 0x2F
+    {nullptr, 0, 0}, {nullptr, 0, 0}, {nullptr, 0, 0}, {nullptr, 0, 0},
+    {nullptr, 0, 0}, {nullptr, 0, 0}, {nullptr, 0, 0}, {nullptr, 0, 0},
+    {nullptr, 0, 0}, {nullptr, 0, 0}, {nullptr, 0, 0}, {nullptr, 0, 0},
+    {nullptr, 0, 0}, {nullptr, 0, 0}, {nullptr, 0, 0}, {nullptr, 0, 0},
+    // 0x30 - 0x3F
+    {nullptr, 0, 0}, {nullptr, 0, 0}, {nullptr, 0, 0}, {nullptr, 0, 0},
+    {nullptr, 0, 0}, {nullptr, 0, 0}, {nullptr, 0, 0}, {nullptr, 0, 0},
+    {nullptr, 0, 0}, {nullptr, 0, 0}, {parseStatus6, 8, 5}, {nullptr, 0, 0},
+    {nullptr, 0, 0}, {nullptr, 0, 0}, {nullptr, 0, 0}, {nullptr, 0, 0}
+  };
+  return table;
+}
+
+// VESC only uses the low 16 bits of the extended ID
+inline bool VESCCore::parseVESCMessage(const VESCFrame& frame) {
+  if ((frame.id & (CAN_ID_EXTENDED | CAN_ID_REMOTE | 0x1FFF0000)) != CAN_ID_EXTENDED) {
+    return false; // Standard, remote or non-VESC extended frame
+  }
+  
+  uint8_t packet_id = (frame.id >> 8) & 0xFF;
+  uint8_t controller_id = frame.id & 0xFF;
+  const StatusHandler& handler = statusHandlers()[packet_id];
+  
+  if (handler.decode == nullptr || frame.len < handler.min_len) {
+    if (controller_id != VESC_HOST_ID) {
+      return false;
+    }
+    return packet_id == PACKET_PONG ? parsePong(frame) : parseBufferFrame(packet_id, frame);
+  }
+  if (discovering.load(std::memory_order_relaxed)) {
+    markDiscovered(controller_id);
+  }
+  
+  VESCData* node = findNode(controller_id);
+  if (node == nullptr) {
+    node = addNode(controller_id);
+    if (node == nullptr) {
+      nodes_rejected++;
+      return false;
+    }
+  }
+  handler.decode(*node, frame.data);
+  
+  // Transports stamp frames on reception; fall back to now if they cannot
+  uint32_t now = frame.timestamp != 0 ? frame.timestamp : clock.micros();
+  bool seen = node->status_seen & (1 << handler.slot);
+  if (node - nodes < VESC_STATS_NODES) {
+    recordArrival(stats[node - nodes][handler.slot], seen ? now - node->status_time[handler.slot] : 0);
+  }
+  node->status_time[handler.slot] = now;
+  node->status_ms[handler.slot] = clock.millis();
+  node->status_seen |= 1 << handler.slot;
+  node->last_update = clock.millis();
+  node->data_valid = true;
+  node->message_count++;
+  publishSnapshot(node - nodes);
+  return true;
+}
+
+inline void VESCCore::parseStatus1(VESCData& d, const uint8_t* msg_data) {
+  int32_t index = 0;
+  d.rpm = buffer_get_int32(msg_data, &index);
+  d.motor_current = buffer_get_int16(msg_data, &index);
+  d.duty_cycle = buffer_get_int16(msg_data, &index);
+}
+
+inline void VESCCore::parseStatus2(VESCData& d, const uint8_t* msg_data) {
+  int32_t index = 0;
+  d.amp_hours = buffer_get_int32(msg_data, &index);
+  d.amp_hours_charged = buffer_get_int32(msg_data, &index);
+}
+
+inline void VESCCore::parseStatus3(VESCData& d, const uint8_t* msg_data) {
+  int32_t index = 0;
+  d.watt_hours = buffer_get_int32(msg_data, &index);
+  d.watt_hours_charged = buffer_get_int32(msg_data, &index);
+}
+
+inline void VESCCore::parseStatus4(VESCData& d, const uint8_t* msg_data) {
+  int32_t index = 0;
+  d.fet_temp = buffer_get_int16(msg_data, &index);
+  d.motor_temp = buffer_get_int16(msg_data, &index);
+  d.input_current = buffer_get_int16(msg_data, &index);
+  d.pid_position = buffer_get_int16(msg_data, &index);
+}
+
+inline void VESCCore::parseStatus5(VESCData& d, const uint8_t* msg_data) {
+  int32_t index = 0;
+  d.tacho_value = buffer_get_int32(msg_data, &index);
+  d.input_voltage = buffer_get_int16(msg_data, &index);
+}
+
+inline void VESCCore::parseStatus6(VESCData& d, const uint8_t* msg_data) {
+  int32_t index = 0;
+  d.adc1 = buffer_get_int16(msg_data, &index);
+  d.adc2 = buffer_get_int16(msg_data, &index);
+  d.adc3 = buffer_get_int16(msg_data, &index);
+  d.ppm = buffer_get_int16(msg_data, &index);
+}
+
+// VESC command format: ID = (command_id << 8) | vesc_id, 4-byte big-endian value
+inline void VESCCore::encodeCommand(VESCFrame& frame, VESCCommandID cmd_id, uint8_t controller_id, int32_t value) {
+  int32_t index = 0;
+  frame.id = CAN_ID_EXTENDED | ((uint32_t)cmd_id << 8) | controller_id;
+  buffer_append_int32(frame.data, value, &index);
+  frame.len = (uint8_t)index;
+}
+
+inline void VESCCore::sendCommand(VESCCommandID cmd_id, uint8_t controller_id, int32_t value) {
+  VESCFrame frame;
+  encodeCommand(frame, cmd_id, controller_id, value);
+  bus.send(frame);
+}
+
+// Long-buffer requests
+// Blocking form of requestValues(): waitForReply() runs until the reply is
+// decoded or the request times out
+inline bool VESCCore::getValues(VESCValues& out, uint8_t controller_id, uint32_t timeout_ms) {
+  return requestValues(controller_id, timeout_ms) && finishRequest(out);
+}
+
+inline bool VESCCore::requestValues(uint8_t controller_id, uint32_t timeout_ms) {
+  const uint8_t command = COMM_GET_VALUES;
+  return startRequest(controller_id, &command, 1, timeout_ms);
+}
+
+// The reply carries only the requested fields, so bus time per poll scales
+// with Mask: voltage, motor current and FET temperature take 3 frames where
+// the full set takes 12
+template <uint32_t Mask>
+inline bool VESCCore::getValuesSelective(VESCValues& out, uint8_t controller_id, uint32_t timeout_ms) {
+  return requestValuesSelective<Mask>(controller_id, timeout_ms) && finishRequest(out);
+}
+
+template <uint32_t Mask>
+inline bool VESCCore::requestValuesSelective(uint8_t controller_id, uint32_t timeout_ms) {
+  static_assert(Mask != 0 && (Mask & ~VALUE_ALL) == 0, "Mask must be VESCValueField bits");
+  return startSelectiveRequest(Mask, controller_id, timeout_ms);
+}
+
+// Request: packet ID and the 32-bit mask, which fits one short buffer
+inline bool VESCCore::startSelectiveRequest(uint32_t mask, uint8_t controller_id, uint32_t timeout_ms) {
+  uint8_t request[5];
+  int32_t index = 0;
+  request[index++] = COMM_GET_VALUES_SELECTIVE;
+  buffer_append_int32(request, (int32_t)mask, &index);
+  return startRequest(controller_id, request, index, timeout_ms);
+}
+
+// Wait out the request just started and copy its reply
+inline bool VESCCore::finishRequest(VESCValues& out) {
+  while (getRequestState() == REQUEST_PENDING) {
+    waitForReply();
+  }
+  if (getRequestState() != REQUEST_DONE) {
+    return false;
+  }
+  out = values;
+  return true;
+}
+
+// Also where timeouts are noticed: a request nobody answers stays pending
+// until someone asks
+inline VESCRequestState VESCCore::getRequestState() {
+  uint8_t state = request_state.load(std::memory_order_acquire);
+  if (state == REQUEST_PENDING && clock.millis() - request_sent_ms >= request_timeout_ms &&
+      request_state.compare_exchange_strong(state, REQUEST_TIMEOUT, std::memory_order_acq_rel)) {
+    request_timeouts++;
+    return REQUEST_TIMEOUT;
+  }
+  return (VESCRequestState)state;
+}
+
+inline const VESCValues& VESCCore::getLastValues() {
+  return values;
+}
+
+// Same framing as comm_can_send_buffer() in the VESC firmware
+inline bool VESCCore::sendBuffer(uint8_t controller_id, const uint8_t* data, uint16_t len, uint8_t mode) {
+  VESCFrame frame;
+  for (uint16_t n = 0; encodeBufferFrame(frame, n, controller_id, VESC_HOST_ID, data, len, mode); n++) {
+    if (!bus.send(frame)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+inline unsigned long VESCCore::getRequestTimeoutCount() {
+  return request_timeouts;
+}
+
+inline unsigned long VESCCore::getBufferErrorCount() {
+  return buffer_errors;
+}
+
+inline void VESCCore::waitForReply() {
+  update(0, 0);
+}
+
+// data[0] is the COMM_ packet ID the reply will echo
+inline bool VESCCore::startRequest(uint8_t controller_id, const uint8_t* data, uint16_t len, uint32_t timeout_ms) {
+  if (getRequestState() == REQUEST_PENDING) {
+    return false;
+  }
+  request_controller = controller_id;
+  request_command = data[0];
+  request_sent_ms = clock.millis();
+  request_timeout_ms = timeout_ms;
+  request_state.store(REQUEST_PENDING, std::memory_order_release);
+  
+  if (!sendBuffer(controller_id, data, len, VESC_BUFFER_PROCESS)) {
+    request_state.store(REQUEST_FAILED, std::memory_order_release);
+    return false;
+  }
+  return true;
+}
+
+// Transfers of up to 6 bytes are one PROCESS_SHORT_BUFFER frame. Longer
+// ones fill the receiver's buffer 7 bytes per frame while the offset fits
+// in a byte (up to offset 252), 6 bytes per frame with a 16-bit offset
+// after that, and end with PROCESS_RX_BUFFER carrying length and CRC.
+inline bool VESCCore::encodeBufferFrame(VESCFrame& frame, uint16_t n, uint8_t controller_id, uint8_t sender_id,
+                                        const uint8_t* data, uint16_t len, uint8_t mode) {
+  uint8_t packet_id;
+  frame.timestamp = 0;
+  
+  if (len <= 6) {
+    if (n != 0) {
+      return false;
+    }
+    packet_id = PACKET_PROCESS_SHORT_BUFFER;
+    frame.data[0] = sender_id;
+    frame.data[1] = mode;
+    memcpy(frame.data + 2, data, len);
+    frame.len = 2 + len;
+  } else {
+    uint16_t short_frames = (len + 6) / 7;
+    short_frames = short_frames > 37 ? 37 : short_frames;  // Offsets 0, 7 ... 252
+    uint16_t short_end = short_frames * 7;
+    uint16_t long_frames = len > short_end ? (len - short_end + 5) / 6 : 0;
+    
+    if (n < short_frames) {
+      uint16_t offset = n * 7;
+      uint8_t chunk = len - offset < 7 ? len - offset : 7;
+      packet_id = PACKET_FILL_RX_BUFFER;
+      frame.data[0] = offset;
+      memcpy(frame.data + 1, data + offset, chunk);
+      frame.len = 1 + chunk;
+    } else if (n < short_frames + long_frames) {
+      uint16_t offset = short_end + (n - short_frames) * 6;
+      uint8_t chunk = len - offset < 6 ? len - offset : 6;
+      packet_id = PACKET_FILL_RX_BUFFER_LONG;
+      frame.data[0] = offset >> 8;
+      frame.data[1] = offset;
+      memcpy(frame.data + 2, data + offset, chunk);
+      frame.len = 2 + chunk;
+    } else if (n == short_frames + long_frames) {
+      unsigned short crc = crc16(data, len);
+      packet_id = PACKET_PROCESS_RX_BUFFER;
+      frame.data[0] = sender_id;
+      frame.data[1] = mode;
+      frame.data[2] = len >> 8;
+      frame.data[3] = len;
+      frame.data[4] = crc >> 8;
+      frame.data[5] = crc;
+      frame.len = 6;
+    } else {
+      return false;
+    }
+  }
+  frame.id = CAN_ID_EXTENDED | ((uint32_t)packet_id << 8) | controller_id;
+  return true;
+}
+
+// Buffer frames addressed to us. Fill frames land in rx_buffer at their
+// offset; the final frame checks length and CRC before the reply is used.
+// Frames normally arrive in order, so the CRC is carried along chunk by
+// chunk and only recomputed in one pass if one did not.
+inline bool VESCCore::parseBufferFrame(uint8_t packet_id, const VESCFrame& frame) {
+  switch (packet_id) {
+    case PACKET_FILL_RX_BUFFER:
+    case PACKET_FILL_RX_BUFFER_LONG: {
+      uint8_t header = packet_id == PACKET_FILL_RX_BUFFER ? 1 : 2;
+      if (frame.len <= header) {
+        return false;
+      }
+      uint16_t offset = header == 1 ? frame.data[0] : ((uint16_t)frame.data[0] << 8) | frame.data[1];
+      uint8_t chunk = frame.len - header;
+      if (offset + chunk > VESC_RX_BUFFER_SIZE) {
+        buffer_errors++;
+        return true;
+      }
+      memcpy(rx_buffer + offset, frame.data + header, chunk);
+      if (offset == 0) {
+        rx_crc = 0;
+        rx_crc_len = 0;
+      }
+      if (offset == rx_crc_len) {
+        rx_crc = crc16_update(rx_crc, frame.data + header, chunk);
+        rx_crc_len += chunk;
+      } else {
+        rx_crc_len = UINT16_MAX;
+      }
+      return true;
+    }
+    case PACKET_PROCESS_RX_BUFFER: {
+      if (frame.len < 6) {
+        return false;
+      }
+      uint16_t len = ((uint16_t)frame.data[2] << 8) | frame.data[3];
+      unsigned short crc = ((unsigned short)frame.data[4] << 8) | frame.data[5];
+      if (len == 0 || len > VESC_RX_BUFFER_SIZE ||
+          (rx_crc_len == len ? rx_crc : crc16(rx_buffer, len)) != crc) {
+        buffer_errors++;
+        return true;
+      }
+      if (frame.data[1] == VESC_BUFFER_REPLY) {
+        handleReply(frame.data[0], rx_buffer, len);
+      }
+      return true;
+    }
+    case PACKET_PROCESS_SHORT_BUFFER:
+      if (frame.len < 3) {
+        return false;
+      }
+      if (frame.data[1] == VESC_BUFFER_REPLY) {
+        handleReply(frame.data[0], frame.data + 2, frame.len - 2);
+      }
+      return true;
+    default:
+      return false;
+  }
+}
+
+// Match a reply to the request in flight; anything else (late replies to a
+// timed-out request, other hosts' traffic on our ID) is dropped
+inline void VESCCore::handleReply(uint8_t sender_id, const uint8_t* data, uint16_t len) {
+  uint8_t state = request_state.load(std::memory_order_acquire);
+  if (state != REQUEST_PENDING || sender_id != request_controller || data[0] != request_command) {
+    return;
+  }
+  
+  switch (data[0]) {
+    case COMM_GET_VALUES:
+      memset(&values, 0, sizeof(values));
+      decodeValues(values, data + 1, len - 1, VALUE_ALL);
+      applyValues(sender_id, values);
+      break;
+    case COMM_GET_VALUES_SELECTIVE: {
+      if (len < 5) {
+        return; // Malformed: let the request time out
+      }
+      int32_t index = 1;
+      uint32_t mask = (uint32_t)buffer_get_int32(data, &index);
+      memset(&values, 0, sizeof(values));
+      decodeValues(values, data + index, len - index, mask);
+      applyValues(sender_id, values);
+      break;
+    }
+    default:
+      break;
+  }
+  request_state.compare_exchange_strong(state, REQUEST_DONE, std::memory_order_acq_rel);
+}
+
+// Decode the fields in mask, in reply order, until the data runs out.
+// Sets out.fields for each one decoded; returns bytes consumed.
+inline uint16_t VESCCore::decodeValues(VESCValues& out, const uint8_t* data, uint16_t len, uint32_t mask) {
+  struct Field {
+    uint8_t size;     // Bytes on the wire; 6 = three int16
+    uint8_t offset;   // Into VESCValues
+  };
+  static const Field fields[VESC_VALUE_FIELD_COUNT] = {
+    {2, offsetof(VESCValues, fet_temp)},
+    {2, offsetof(VESCValues, motor_temp)},
+    {4, offsetof(VESCValues, motor_current)},
+    {4, offsetof(VESCValues, input_current)},
+    {4, offsetof(VESCValues, id_current)},
+    {4, offsetof(VESCValues, iq_current)},
+    {2, offsetof(VESCValues, duty_cycle)},
+    {4, offsetof(VESCValues, rpm)},
+    {2, offsetof(VESCValues, input_voltage)},
+    {4, offsetof(VESCValues, amp_hours)},
+    {4, offsetof(VESCValues, amp_hours_charged)},
+    {4, offsetof(VESCValues, watt_hours)},
+    {4, offsetof(VESCValues, watt_hours_charged)},
+    {4, offsetof(VESCValues, tacho_value)},
+    {4, offsetof(VESCValues, tacho_abs)},
+    {1, offsetof(VESCValues, fault_code)},
+    {4, offsetof(VESCValues, pid_position)},
+    {1, offsetof(VESCValues, controller_id)},
+    {6, offsetof(VESCValues, mos_temp)},
+    {4, offsetof(VESCValues, vd)},
+    {4, offsetof(VESCValues, vq)}
+  };
+  
+  int32_t index = 0;
+  uint8_t* base = (uint8_t*)&out;
+  for (uint8_t i = 0; i < VESC_VALUE_FIELD_COUNT; i++) {
+    if (!(mask & (1UL << i))) {
+      continue;
+    }
+    const Field& f = fields[i];
+    if (index + f.size > len) {
+      break;
+    }
+    if (f.size == 1) {
+      base[f.offset] = data[index++];
+    } else if (f.size == 4) {
+      int32_t v = buffer_get_int32(data, &index);
+      memcpy(base + f.offset, &v, sizeof(v));
+    } else {
+      for (uint8_t k = 0; k < f.size / 2; k++) {
+        int16_t v = buffer_get_int16(data, &index);
+        memcpy(base + f.offset + 2 * k, &v, sizeof(v));
+      }
+    }
+    out.fields |= 1UL << i;
+  }
+  return (uint16_t)index;
+}
+
+// Fold the fields VESCData also has into the node, converted to its scales
+inline void VESCCore::applyValues(uint8_t controller_id, const VESCValues& v) {
+  VESCData* node = findNode(controller_id);
+  if (node == nullptr) {
+    node = addNode(controller_id);
+    if (node == nullptr) {
+      return;
+    }
+  }
+  if (v.fields & VALUE_FET_TEMP) {
+    node->fet_temp = v.fet_temp;
+  }
+  if (v.fields & VALUE_MOTOR_TEMP) {
+    node->motor_temp = v.motor_temp;
+  }
+  if (v.fields & VALUE_MOTOR_CURRENT) {
+    node->motor_current = v.motor_current / 10;
+  }
+  if (v.fields & VALUE_INPUT_CURRENT) {
+    node->input_current = v.input_current / 10;
+  }
+  if (v.fields & VALUE_DUTY) {
+    node->duty_cycle = v.duty_cycle;
+  }
+  if (v.fields & VALUE_RPM) {
+    node->rpm = v.rpm;
+  }
+  if (v.fields & VALUE_VOLTAGE) {
+    node->input_voltage = v.input_voltage;
+  }
+  if (v.fields & VALUE_AMP_HOURS) {
+    node->amp_hours = v.amp_hours;
+  }
+  if (v.fields & VALUE_AMP_HOURS_CHARGED) {
+    node->amp_hours_charged = v.amp_hours_charged;
+  }
+  if (v.fields & VALUE_WATT_HOURS) {
+    node->watt_hours = v.watt_hours;
+  }
+  if (v.fields & VALUE_WATT_HOURS_CHARGED) {
+    node->watt_hours_charged = v.watt_hours_charged;
+  }
+  if (v.fields & VALUE_TACHO) {
+    node->tacho_value = v.tacho_value;
+  }
+  if (v.fields & VALUE_PID_POSITION) {
+    node->pid_position = v.pid_position / 20000;
+  }
+  node->last_update = clock.millis();
+  node->data_valid = true;
+  node->message_count++;
+  publishSnapshot(node - nodes);
+}
+
+// Round-trip probe
+// Round trips run from the moment the PING is handed to the transport to the
+// PONG's receive timestamp, so time spent queued behind other frames or
+// losing arbitration counts: that is the delay our commands see too.
+inline bool VESCCore::ping(uint32_t& rtt_us, uint8_t controller_id, uint32_t timeout_ms) {
+  int8_t i = startPing(controller_id, timeout_ms);
+  if (i < 0) {
+    return false;
+  }
+  PingSlot& slot = ping_slots[i];
+  uint8_t state;
+  while ((state = slot.state.load(std::memory_order_acquire)) == PING_PENDING || state == PING_ANSWERING) {
+    waitForReply();
+    expirePings();
+  }
+  if (state != PING_ANSWERED || slot.controller_id != controller_id) {
+    return false;
+  }
+  rtt_us = slot.rtt_us;
+  return true;
+}
+
+inline bool VESCCore::sendPing(uint8_t controller_id, uint32_t timeout_ms) {
+  return startPing(controller_id, timeout_ms) >= 0;
+}
+
+inline void VESCCore::setPingInterval(uint32_t period_ms, uint8_t controller_id) {
+  ping_target = controller_id;
+  ping_last_ms = clock.millis() - period_ms;  // First ping on the next update()
+  ping_period_ms = period_ms;
+}
+
+// Empty for controllers without one of the VESC_PING_STATS_NODES histograms
+inline const VESCLatencyHistogram& VESCCore::getPingStats(uint8_t controller_id) {
+  static const VESCLatencyHistogram empty = {};
+  VESCLatencyHistogram* h = findPingStats(controller_id, false);
+  return h != nullptr ? *h : empty;
+}
+
+inline void VESCCore::resetPingStats(uint8_t controller_id) {
+  VESCLatencyHistogram* h = findPingStats(controller_id, false);
+  if (h != nullptr) {
+    memset(h, 0, sizeof(VESCLatencyHistogram));
+  }
+}
+
+// Histogram of a controller, given a free one first if add is set
+inline VESCLatencyHistogram* VESCCore::findPingStats(uint8_t controller_id, bool add) {
+  for (uint8_t i = 0; i < ping_stats_count; i++) {
+    if (ping_stats_ids[i] == controller_id) {
+      return &ping_stats[i];
+    }
+  }
+  if (!add || ping_stats_count >= VESC_PING_STATS_NODES) {
+    return nullptr;
+  }
+  ping_stats_ids[ping_stats_count] = controller_id;
+  return &ping_stats[ping_stats_count++];
+}
+
+inline unsigned long VESCCore::getPingTimeoutCount() {
+  expirePings();
+  return ping_timeouts;
+}
+
+// A PONG only names the controller, so one ping per controller at a time
+inline int8_t VESCCore::startPing(uint8_t controller_id, uint32_t timeout_ms, bool probe) {
+  expirePings();
+  int8_t claimed = -1;
+  for (uint8_t i = 0; i < VESC_PING_SLOTS; i++) {
+    PingSlot& slot = ping_slots[i];
+    uint8_t state = slot.state.load(std::memory_order_acquire);
+    if (state == PING_PENDING && slot.controller_id == controller_id) {
+      if (claimed >= 0) {
+        ping_slots[claimed].state.store(PING_FREE, std::memory_order_release);
+      }
+      return -1;
+    }
+    // Prefer free slots, so an answer is not overwritten before it is read
+    if (claimed < 0 && state == PING_FREE &&
+        slot.state.compare_exchange_strong(state, PING_CLAIMED, std::memory_order_acq_rel)) {
+      claimed = i;
+    }
+  }
+  for (uint8_t i = 0; claimed < 0 && i < VESC_PING_SLOTS; i++) {
+    uint8_t state = PING_ANSWERED;
+    if (ping_slots[i].state.compare_exchange_strong(state, PING_CLAIMED, std::memory_order_acq_rel)) {
+      claimed = i;
+    }
+  }
+  if (claimed < 0) {
+    return -1;
+  }
+  
+  PingSlot& slot = ping_slots[claimed];
+  slot.controller_id = controller_id;
+  slot.timeout_ms = timeout_ms;
+  slot.probe = probe;
+  slot.sent_ms = clock.millis();
+  slot.sent_us = clock.micros();
+  slot.state.store(PING_PENDING, std::memory_order_release);
+  
+  VESCFrame frame;
+  frame.id = CAN_ID_EXTENDED | ((uint32_t)PACKET_PING << 8) | controller_id;
+  frame.len = 1;
+  frame.data[0] = VESC_HOST_ID;
+  frame.timestamp = 0;
+  if (!bus.send(frame)) {
+    slot.state.store(PING_FREE, std::memory_order_release);
+    return -1;
+  }
+  return claimed;
+}
+
+// PONGs nobody waits for (late, or another host's) are dropped
+inline bool VESCCore::parsePong(const VESCFrame& frame) {
+  if (frame.len < 1) {
+    return false;
+  }
+  uint32_t now = frame.timestamp != 0 ? frame.timestamp : clock.micros();
+  uint8_t controller_id = frame.data[0];
+  if (discovering.load(std::memory_order_relaxed)) {
+    markDiscovered(controller_id);  // Late PONGs count too
+  }
+  expirePings();  // A PONG after the timeout is a timeout, whoever checks first
+  for (uint8_t i = 0; i < VESC_PING_SLOTS; i++) {
+    PingSlot& slot = ping_slots[i];
+    uint8_t state = PING_PENDING;
+    if (slot.controller_id != controller_id || slot.state.load(std::memory_order_acquire) != PING_PENDING) {
+      continue;
+    }
+    if (!slot.state.compare_exchange_strong(state, PING_ANSWERING, std::memory_order_acq_rel)) {
+      continue;  // Expired meanwhile, the slot may belong to a new ping now
+    }
+    uint32_t rtt = now - slot.sent_us;
+    slot.rtt_us = rtt;
+    bool probe = slot.probe;
+    slot.state.store(PING_ANSWERED, std::memory_order_release);
+    // Discovery answers go to the discovered bitmap only: a sweep must not
+    // hand out histograms (or node slots) to every controller on the bus
+    VESCLatencyHistogram* h = probe ? nullptr : findPingStats(controller_id, true);
+    if (h != nullptr) {
+      h->record(rtt);
+    }
+    break;
+  }
+  return true;
+}
+
+inline void VESCCore::expirePings() {
+  uint32_t now = clock.millis();
+  for (uint8_t i = 0; i < VESC_PING_SLOTS; i++) {
+    PingSlot& slot = ping_slots[i];
+    uint8_t state = PING_PENDING;
+    if (slot.state.load(std::memory_order_acquire) == PING_PENDING && now - slot.sent_ms >= slot.timeout_ms &&
+        slot.state.compare_exchange_strong(state, PING_FREE, std::memory_order_acq_rel)) {
+      ping_timeouts += !slot.probe;
+    }
+  }
+}
+
+// Fixed-rate pings from update(). The schedule does not slip when a ping
+// cannot go out because the previous one is still waiting for its PONG.
+inline void VESCCore::servicePing() {
+  uint32_t now = clock.millis();
+  if (now - ping_last_ms < ping_period_ms) {
+    return;
+  }
+  ping_last_ms += ping_period_ms;
+  if (now - ping_last_ms >= ping_period_ms) {
+    ping_last_ms = now;  // Catch up after a stall without a burst
+  }
+  sendPing(ping_target, ping_period_ms < VESC_REQUEST_TIMEOUT_MS ? ping_period_ms : VESC_REQUEST_TIMEOUT_MS);
+}
+
+// Node discovery
+// Sweeps IDs 0-254 with VESC_PING_SLOTS pings in flight, refilling a slot
+// as soon as its PONG arrives or it times out, while status frames from
+// any controller are noted as they pass. IDs already heard from are not
+// pinged. An ID that cannot be pinged right now (send failed, or one of
+// our own pings to it is still pending) is tried again in a second pass.
+// With nobody answering, the sweep takes about
+// 255 / VESC_PING_SLOTS * VESC_DISCOVERY_PING_MS (320 ms).
+inline uint8_t VESCCore::discover(uint8_t* ids, uint8_t max_ids, uint32_t timeout_ms) {
+  uint8_t todo[32];               // IDs not pinged yet, a bit per ID
+  for (uint8_t i = 0; i < 32; i++) {
+    discovered[i].store(0, std::memory_order_relaxed);
+    todo[i] = 0xFF;
+  }
+  todo[VESC_HOST_ID >> 3] &= ~(1 << (VESC_HOST_ID & 7));
+  discovering.store(true, std::memory_order_release);
+  
+  uint32_t start = clock.millis();
+  uint16_t next = 0;
+  uint8_t pass = 0;
+  while (clock.millis() - start < timeout_ms) {
+    while (next < 255) {
+      uint8_t bit = 1 << (next & 7);
+      if ((todo[next >> 3] & bit) && !isDiscovered((uint8_t)next)) {
+        bool slot_free = false;
+        for (uint8_t i = 0; i < VESC_PING_SLOTS; i++) {
+          uint8_t state = ping_slots[i].state.load(std::memory_order_acquire);
+          slot_free |= state == PING_FREE || state == PING_ANSWERED;
+        }
+        if (!slot_free) {
+          break;  // All slots busy: wait for PONGs or timeouts
+        }
+        if (startPing(next, VESC_DISCOVERY_PING_MS, true) >= 0) {
+          todo[next >> 3] &= ~bit;
+        }
+      }
+      next++;
+    }
+    
+    // Only our own probes are waited for, not the application's pings
+    bool pending = false;
+    for (uint8_t i = 0; i < VESC_PING_SLOTS; i++) {
+      pending |= ping_slots[i].state.load(std::memory_order_acquire) == PING_PENDING && ping_slots[i].probe;
+    }
+    if (next >= 255 && !pending) {
+      if (pass > 0) {
+        break;
+      }
+      next = 0;  // Second pass over the IDs skipped in the first
+      pass++;
+      continue;
+    }
+    waitForReply();
+    expirePings();
+  }
+  discovering.store(false, std::memory_order_release);
+  
+  uint8_t found = 0;
+  for (uint16_t id = 0; id < 255 && found < max_ids; id++) {
+    if (isDiscovered((uint8_t)id)) {
+      ids[found++] = (uint8_t)id;
+    }
+  }
+  return found;
+}
+
+inline bool VESCCore::isDiscovered(uint8_t controller_id) {
+  return discovered[controller_id >> 3].load(std::memory_order_relaxed) & (1 << (controller_id & 7));
+}
+
+inline void VESCCore::markDiscovered(uint8_t controller_id) {
+  discovered[controller_id >> 3].fetch_or(1 << (controller_id & 7), std::memory_order_relaxed);
+}
@@ -0,0 +1,643 @@
+#pragma once
+// Simulated VESC controllers for testing without hardware.
+//
+// VESCSimNode models one controller: a DC motor with back-EMF, a battery
+// with internal resistance and FET/motor heating. It accepts the same
+// CMD_SET_DUTY / CURRENT / CURRENT_BRAKE / RPM frames a real VESC does and
+// publishes STATUS_1-6 with the encodings VESCCore::parseStatus1..6 expect.
+// COMM_GET_VALUES and COMM_GET_VALUES_SELECTIVE sent as short buffers are
+// answered over long buffers, CAN_PACKET_PING with a PONG.
+//
+// VESCSimulator runs any number of nodes on a VESCCanBus, either SocketCAN
+// (see vesc_sim.cpp) or VESCLoopbackBus for in-process tests, and paces
+// transmissions to a bus bitrate so saturation tests see real frame rates.
+//
+// Header-only, C++11, host only (the model uses floating point).
+#include <math.h>
+#include "VESC_Core.h"
+
+// Simulator Configuration
+constexpr uint8_t SIM_MAX_NODES = 16;         // Controllers per VESCSimulator
+constexpr uint16_t LOOPBACK_RING_SIZE = 256;  // Frames buffered per loopback direction
+constexpr uint16_t SIM_MAX_STEP_FRAMES = 256; // Frames sent per step() at most
+constexpr uint8_t SIM_REPLY_FRAMES = 32;      // Reply frames queued per node
+
+// Bits on the wire for an extended data frame, including worst-case stuffing
+inline uint32_t canFrameBits(uint8_t len) {
+  uint32_t stuffed = 54 + 8 * len;  // SOF to end of CRC is subject to stuffing
+  return 67 + 8 * len + (stuffed - 1) / 4;
+}
+
+// VESCClock the test drives by hand, for deterministic in-process runs
+class VESCSimClock : public VESCClock {
+public:
+  VESCSimClock() : now_us(0) {}
+  
+  uint32_t millis() override {
+    return (uint32_t)(now_us / 1000);
+  }
+  
+  uint32_t micros() override {
+    return (uint32_t)now_us;
+  }
+  
+  void set(uint64_t us) { now_us = us; }
+  void advance(uint32_t us) { now_us += us; }
+
+private:
+  uint64_t now_us;
+};
+
+// In-process CAN bus: two connected endpoints, each one's send() arrives at
+// the other's receive(). Single-threaded use only.
+class VESCLoopbackBus : public VESCCanBus {
+public:
+  explicit VESCLoopbackBus(VESCClock* clock = nullptr)
+    : peer(nullptr), clock(clock), dropped(0) {}
+  
+  void connect(VESCLoopbackBus& other) {
+    peer = &other;
+    other.peer = this;
+  }
+  
+  // VESCCanBus
+  bool send(const VESCFrame& frame) override {
+    if (peer == nullptr) {
+      return false;
+    }
+    VESCFrame copy = frame;
+    copy.timestamp = clock != nullptr ? clock->micros() : 0;
+    if (!peer->ring.push(copy)) {
+      peer->dropped++;  // Receiver overrun, as on a real controller
+      return false;
+    }
+    return true;
+  }
+  
+  bool receive(VESCFrame& frame) override {
+    return ring.pop(frame);
+  }
+  
+  uint16_t pending() override {
+    return ring.size();
+  }
+  
+  unsigned long getDroppedFrameCount() { return dropped; }
+
+private:
+  VESCLoopbackBus* peer;
+  VESCClock* clock;
+  VESCFrameRing<LOOPBACK_RING_SIZE> ring;
+  unsigned long dropped;
+};
+
+// Motor, battery and thermal model parameters
+struct VESCSimParams {
+  float battery_voltage = 48.0f;      // Open-circuit voltage, V
+  float battery_resistance = 0.08f;   // Pack internal resistance, ohm
+  float motor_kv = 1000.0f;           // ERPM per volt of back-EMF
+  float motor_resistance = 0.1f;      // Phase resistance, ohm
+  float max_current = 60.0f;          // Motor current limit, A
+  float max_duty = 0.95f;             // Duty limit, as in the firmware
+  float accel_per_amp = 400.0f;       // ERPM/s per amp of motor current
+  float friction = 0.5f;              // Viscous loss, fraction of ERPM per second
+  float rpm_kp = 0.1f;                // Speed loop gain, A per ERPM of error
+  float ambient_temp = 25.0f;         // C
+  float fet_heating = 0.002f;         // C/s per A^2
+  float motor_heating = 0.004f;       // C/s per A^2
+  float cooling = 0.02f;              // Fraction of the excess over ambient lost per second
+  uint32_t command_timeout_ms = 1000; // Release the motor when commands stop
+};
+
+// One simulated controller
+class VESCSimNode {
+public:
+  explicit VESCSimNode(uint8_t controller_id, const VESCSimParams& params = VESCSimParams())
+    : id(controller_id), p(params), mode(MODE_OFF), setpoint(0), last_command_us(0),
+      last_advance_us(0), started(false), erpm(0), motor_current(0), input_current(0),
+      duty(0), voltage(params.battery_voltage), amp_hours(0), amp_hours_charged(0),
+      watt_hours(0), watt_hours_charged(0), fet_temp(params.ambient_temp),
+      motor_temp(params.ambient_temp), tacho(0), saturate(false), status6_packet(PACKET_STATUS_6),
+      next_status(0), commands(0), reply_count(0), reply_next(0), requests(0),
+      pong_due(false), pong_to(0), pings(0) {
+    for (uint8_t i = 0; i < 6; i++) {
+      period_us[i] = 0;
+      next_due_us[i] = 0;
+    }
+    setRate(PACKET_STATUS_1, 50);
+    setRate(PACKET_STATUS_5, 50);
+    setRate(PACKET_STATUS_2, 10);
+    setRate(PACKET_STATUS_3, 10);
+    setRate(PACKET_STATUS_4, 10);
+    setRate(PACKET_STATUS_6, 10);
+  }
+  
+  uint8_t getID() { return id; }
+  
+  // Status publishing. hz = 0 disables a message; STATUS_6 is published on
+  // PACKET_STATUS_6 or PACKET_STATUS_6_ALT, whichever packet is passed last.
+  void setRate(VESCPacketID packet, uint16_t hz) {
+    int8_t slot = statusSlot(packet);
+    if (slot < 0) {
+      return;
+    }
+    if (slot == 5) {
+      status6_packet = packet;
+    }
+    period_us[slot] = hz != 0 ? 1000000UL / hz : 0;
+  }
+  
+  // Publish every status message back to back whenever the bus has room
+  void setSaturate(bool enabled) { saturate = enabled; }
+  
+  // Apply a frame seen on the bus, true if it was a command for this node
+  bool handleFrame(const VESCFrame& frame, uint32_t now_us) {
+    if ((frame.id & (CAN_ID_EXTENDED | CAN_ID_REMOTE | 0x1FFF0000)) != CAN_ID_EXTENDED) {
+      return false;
+    }
+    uint8_t packet_id = (frame.id >> 8) & 0xFF;
+    uint8_t target = frame.id & 0xFF;
+    if (target != id && target != 0xFF) {
+      return false;
+    }
+    if (packet_id == PACKET_PROCESS_SHORT_BUFFER && target == id) {
+      return handleShortBuffer(frame);
+    }
+    if (packet_id == PACKET_PING && target == id && frame.len >= 1) {
+      pong_due = true;
+      pong_to = frame.data[0];
+      pings++;
+      return true;
+    }
+    if (packet_id > CMD_SET_RPM || frame.len < 4) {
+      return false;
+    }
+    int32_t index = 0;
+    setpoint = buffer_get_int32(frame.data, &index);
+    mode = (Mode)(MODE_DUTY + packet_id);
+    last_command_us = now_us;
+    commands++;
+    return true;
+  }
+  
+  // Integrate the model up to now_us
+  void advance(uint32_t now_us) {
+    if (!started) {
+      started = true;
+      last_advance_us = now_us;
+      last_command_us = now_us;
+      return;
+    }
+    float dt = (uint32_t)(now_us - last_advance_us) / 1e6f;
+    last_advance_us = now_us;
+    if (dt <= 0) {
+      return;
+    }
+    
+    if (mode != MODE_OFF && now_us - last_command_us > p.command_timeout_ms * 1000) {
+      mode = MODE_OFF;
+    }
+    
+    // Motor current from the active mode
+    float back_emf = erpm / p.motor_kv;
+    float current = 0;
+    switch (mode) {
+      case MODE_DUTY: {
+        // Wire value is duty x 100000 (see VESCCore::setDutyCycle)
+        float d = clampf(setpoint / 100000.0f, p.max_duty);
+        current = (d * voltage - back_emf) / p.motor_resistance;
+        break;
+      }
+      case MODE_CURRENT:
+        current = setpoint / 1000.0f;
+        break;
+      case MODE_CURRENT_BRAKE:
+        current = fabsf(setpoint / 1000.0f);
+        current = erpm > 0 ? -current : (erpm < 0 ? current : 0);
+        break;
+      case MODE_RPM:
+        current = (setpoint - erpm) * p.rpm_kp;
+        break;
+      default:
+        break;
+    }
+    current = clampf(current, p.max_current);
+    
+    // Duty needed to drive that current, limited by the supply
+    duty = mode == MODE_OFF ? 0 : clampf((back_emf + current * p.motor_resistance) / voltage, p.max_duty);
+    if (mode != MODE_OFF && mode != MODE_DUTY && fabsf(duty) >= p.max_duty) {
+      current = clampf((duty * voltage - back_emf) / p.motor_resistance, p.max_current);
+    }
+    motor_current = current;
+    
+    // Mechanics; braking stops the motor rather than reversing it
+    float new_erpm = erpm + (current * p.accel_per_amp - erpm * p.friction) * dt;
+    if (mode == MODE_CURRENT_BRAKE && new_erpm * erpm <= 0) {
+      new_erpm = 0;
+      motor_current = 0;
+    }
+    erpm = new_erpm;
+    tacho += erpm / 60.0f * 6.0f * dt;  // Six commutation steps per electrical turn
+    
+    // Battery side
+    input_current = motor_current * duty;
+    voltage = p.battery_voltage - input_current * p.battery_resistance;
+    float ah = input_current * dt / 3600.0f;
+    if (ah >= 0) {
+      amp_hours += ah;
+      watt_hours += ah * voltage;
+    } else {
+      amp_hours_charged -= ah;
+      watt_hours_charged -= ah * voltage;
+    }
+    
+    // Thermal
+    float i2 = motor_current * motor_current;
+    fet_temp += (i2 * p.fet_heating - (fet_temp - p.ambient_temp) * p.cooling) * dt;
+    motor_temp += (i2 * p.motor_heating - (motor_temp - p.ambient_temp) * p.cooling) * dt;
+  }
+  
+  // Next frame to send at now_us: a PONG, a queued reply, or a status frame
+  // that is due. False if there is none.
+  bool nextFrame(VESCFrame& frame, uint32_t now_us) {
+    if (pong_due) {
+      pong_due = false;
+      frame.id = CAN_ID_EXTENDED | ((uint32_t)PACKET_PONG << 8) | pong_to;
+      frame.len = 2;
+      frame.data[0] = id;
+      frame.data[1] = 0;  // HW_TYPE_VESC
+      frame.timestamp = 0;
+      return true;
+    }
+    if (reply_next < reply_count) {
+      frame = reply[reply_next++];
+      return true;
+    }
+    for (uint8_t n = 0; n < 6; n++) {
+      uint8_t slot = (next_status + n) % 6;
+      if (period_us[slot] == 0 && !saturate) {
+        continue;
+      }
+      if (!saturate) {
+        if ((int32_t)(now_us - next_due_us[slot]) < 0) {
+          continue;
+        }
+        // Catch up after a stall without bursting the backlog
+        next_due_us[slot] += period_us[slot];
+        if ((int32_t)(now_us - next_due_us[slot]) >= 0) {
+          next_due_us[slot] = now_us + period_us[slot];
+        }
+      }
+      next_status = (slot + 1) % 6;
+      encodeStatus(frame, slot);
+      return true;
+    }
+    return false;
+  }
+  
+  // Model state
+  float getERPM() { return erpm; }
+  float getMotorCurrent() { return motor_current; }
+  float getInputCurrent() { return input_current; }
+  float getDuty() { return duty; }
+  float getVoltage() { return voltage; }
+  float getFETTemp() { return fet_temp; }
+  unsigned long getCommandCount() { return commands; }
+  unsigned long getRequestCount() { return requests; }
+  unsigned long getPingCount() { return pings; }
+
+private:
+  enum Mode {
+    MODE_DUTY = 0,  // Same order as VESCCommandID
+    MODE_CURRENT,
+    MODE_CURRENT_BRAKE,
+    MODE_RPM,
+    MODE_OFF
+  };
+  
+  uint8_t id;
+  VESCSimParams p;
+  
+  // Command state
+  Mode mode;
+  int32_t setpoint;
+  uint32_t last_command_us;
+  uint32_t last_advance_us;
+  bool started;
+  
+  // Model state
+  float erpm;
+  float motor_current;
+  float input_current;
+  float duty;
+  float voltage;
+  float amp_hours;
+  float amp_hours_charged;
+  float watt_hours;
+  float watt_hours_charged;
+  float fet_temp;
+  float motor_temp;
+  float tacho;
+  
+  // Status schedule, slots in STATUS_1..6 order
+  uint32_t period_us[6];
+  uint32_t next_due_us[6];
+  bool saturate;
+  VESCPacketID status6_packet;
+  uint8_t next_status;
+  unsigned long commands;
+  
+  // Long-buffer reply being sent
+  VESCFrame reply[SIM_REPLY_FRAMES];
+  uint8_t reply_count;
+  uint8_t reply_next;
+  unsigned long requests;
+  
+  // PONG owed to the last PING
+  bool pong_due;
+  uint8_t pong_to;
+  unsigned long pings;
+  
+  static float clampf(float value, float limit) {
+    return value < -limit ? -limit : (value > limit ? limit : value);
+  }
+  
+  static int8_t statusSlot(VESCPacketID packet) {
+    switch (packet) {
+      case PACKET_STATUS_1: return 0;
+      case PACKET_STATUS_2: return 1;
+      case PACKET_STATUS_3: return 2;
+      case PACKET_STATUS_4: return 3;
+      case PACKET_STATUS_5: return 4;
+      case PACKET_STATUS_6:
+      case PACKET_STATUS_6_ALT: return 5;
+      default: return -1;
+    }
+  }
+  
+  // Requests that fit one frame; longer ones are not simulated
+  bool handleShortBuffer(const VESCFrame& frame) {
+    if (frame.len < 3 || frame.data[1] != VESC_BUFFER_PROCESS) {
+      return false;
+    }
+    uint8_t sender = frame.data[0];
+    uint8_t payload[128];
+    int32_t len = 0;
+    switch (frame.data[2]) {
+      case COMM_GET_VALUES:
+        payload[len++] = COMM_GET_VALUES;
+        encodeValues(payload, &len, VALUE_ALL);
+        break;
+      case COMM_GET_VALUES_SELECTIVE: {
+        if (frame.len < 7) {
+          return false;
+        }
+        int32_t index = 3;
+        uint32_t mask = (uint32_t)buffer_get_int32(frame.data, &index);
+        payload[len++] = COMM_GET_VALUES_SELECTIVE;
+        buffer_append_int32(payload, (int32_t)mask, &len);
+        encodeValues(payload, &len, mask);
+        break;
+      }
+      default:
+        return false;
+    }
+    requests++;
+    
+    reply_count = 0;
+    reply_next = 0;
+    while (reply_count < SIM_REPLY_FRAMES &&
+           VESCCore::encodeBufferFrame(reply[reply_count], reply_count, sender, id, payload, len, VESC_BUFFER_REPLY)) {
+      reply_count++;
+    }
+    return true;
+  }
+  
+  // COMM_GET_VALUES reply body, firmware 6.x layout, fields in mask only
+  void encodeValues(uint8_t* buffer, int32_t* index, uint32_t mask) {
+    float revolutions = tacho / 6.0f;
+    float position = (revolutions - floorf(revolutions)) * 360.0f;
+    if (mask & VALUE_FET_TEMP) {
+      buffer_append_int16(buffer, (int16_t)(fet_temp * 10.0f), index);
+    }
+    if (mask & VALUE_MOTOR_TEMP) {
+      buffer_append_int16(buffer, (int16_t)(motor_temp * 10.0f), index);
+    }
+    if (mask & VALUE_MOTOR_CURRENT) {
+      buffer_append_int32(buffer, (int32_t)(motor_current * 100.0f), index);
+    }
+    if (mask & VALUE_INPUT_CURRENT) {
+      buffer_append_int32(buffer, (int32_t)(input_current * 100.0f), index);
+    }
+    if (mask & VALUE_ID_CURRENT) {
+      buffer_append_int32(buffer, 0, index);  // The model has no d axis
+    }
+    if (mask & VALUE_IQ_CURRENT) {
+      buffer_append_int32(buffer, (int32_t)(motor_current * 100.0f), index);
+    }
+    if (mask & VALUE_DUTY) {
+      buffer_append_int16(buffer, (int16_t)(duty * 1000.0f), index);
+    }
+    if (mask & VALUE_RPM) {
+      buffer_append_int32(buffer, (int32_t)erpm, index);
+    }
+    if (mask & VALUE_VOLTAGE) {
+      buffer_append_int16(buffer, (int16_t)(voltage * 10.0f), index);
+    }
+    if (mask & VALUE_AMP_HOURS) {
+      buffer_append_int32(buffer, (int32_t)(amp_hours * 10000.0f), index);
+    }
+    if (mask & VALUE_AMP_HOURS_CHARGED) {
+      buffer_append_int32(buffer, (int32_t)(amp_hours_charged * 10000.0f), index);
+    }
+    if (mask & VALUE_WATT_HOURS) {
+      buffer_append_int32(buffer, (int32_t)(watt_hours * 10000.0f), index);
+    }
+    if (mask & VALUE_WATT_HOURS_CHARGED) {
+      buffer_append_int32(buffer, (int32_t)(watt_hours_charged * 10000.0f), index);
+    }
+    if (mask & VALUE_TACHO) {
+      buffer_append_int32(buffer, (int32_t)tacho, index);
+    }
+    if (mask & VALUE_TACHO_ABS) {
+      buffer_append_int32(buffer, (int32_t)fabsf(tacho), index);
+    }
+    if (mask & VALUE_FAULT) {
+      buffer[(*index)++] = 0;  // No fault
+    }
+    if (mask & VALUE_PID_POSITION) {
+      buffer_append_int32(buffer, (int32_t)(position * 1000000.0f), index);
+    }
+    if (mask & VALUE_CONTROLLER_ID) {
+      buffer[(*index)++] = id;
+    }
+    if (mask & VALUE_MOS_TEMPS) {
+      for (uint8_t i = 0; i < 3; i++) {
+        buffer_append_int16(buffer, (int16_t)(fet_temp * 10.0f), index);
+      }
+    }
+    if (mask & VALUE_VD) {
+      buffer_append_int32(buffer, 0, index);
+    }
+    if (mask & VALUE_VQ) {
+      buffer_append_int32(buffer, (int32_t)(duty * voltage * 1000.0f), index);
+    }
+  }
+  
+  // Same layouts as VESCCore::parseStatus1..6
+  void encodeStatus(VESCFrame& frame, uint8_t slot) {
+    static const uint8_t packets[5] = {
+      PACKET_STATUS_1, PACKET_STATUS_2, PACKET_STATUS_3, PACKET_STATUS_4, PACKET_STATUS_5
+    };
+    uint8_t packet_id = slot < 5 ? packets[slot] : (uint8_t)status6_packet;
+    int32_t index = 0;
+    memset(frame.data, 0, sizeof(frame.data));
+    
+    switch (slot) {
+      case 0:
+        buffer_append_int32(frame.data, (int32_t)erpm, &index);
+        buffer_append_int16(frame.data, (int16_t)(motor_current * 10.0f), &index);
+        buffer_append_int16(frame.data, (int16_t)(duty * 1000.0f), &index);
+        break;
+      case 1:
+        buffer_append_int32(frame.data, (int32_t)(amp_hours * 10000.0f), &index);
+        buffer_append_int32(frame.data, (int32_t)(amp_hours_charged * 10000.0f), &index);
+        break;
+      case 2:
+        buffer_append_int32(frame.data, (int32_t)(watt_hours * 10000.0f), &index);
+        buffer_append_int32(frame.data, (int32_t)(watt_hours_charged * 10000.0f), &index);
+        break;
+      case 3: {
+        float revolutions = tacho / 6.0f;
+        float position = (revolutions - floorf(revolutions)) * 360.0f;
+        buffer_append_int16(frame.data, (int16_t)(fet_temp * 10.0f), &index);
+        buffer_append_int16(frame.data, (int16_t)(motor_temp * 10.0f), &index);
+        buffer_append_int16(frame.data, (int16_t)(input_current * 10.0f), &index);
+        buffer_append_int16(frame.data, (int16_t)(position * 50.0f), &index);
+        break;
+      }
+      case 4:
+        buffer_append_int32(frame.data, (int32_t)tacho, &index);
+        buffer_append_int16(frame.data, (int16_t)(voltage * 10.0f), &index);
+        index += 2;  // Reserved
+        break;
+      default:
+        buffer_append_int16(frame.data, 0, &index);  // ADC1-3: nothing connected
+        buffer_append_int16(frame.data, 0, &index);
+        buffer_append_int16(frame.data, 0, &index);
+        buffer_append_int16(frame.data, (int16_t)(duty * 1000.0f), &index);  // PPM follows the throttle
+        break;
+    }
+    frame.id = CAN_ID_EXTENDED | ((uint32_t)packet_id << 8) | id;
+    frame.len = (uint8_t)index;
+    frame.timestamp = 0;
+  }
+};
+
+// Runs simulated nodes on a bus: feeds them received commands, steps their
+// models and sends their status frames, never faster than the bitrate allows.
+class VESCSimulator {
+public:
+  VESCSimulator(VESCCanBus& bus, VESCClock& clock)
+    : bus(bus), clock(clock), node_count(0), next_node(0), bitrate(0),
+      bit_credit(0), last_step_us(0), started(false), tx_frames(0), tx_bits(0),
+      tx_failed(0), rx_frames(0) {}
+  
+  bool addNode(VESCSimNode& node) {
+    if (node_count >= SIM_MAX_NODES) {
+      return false;
+    }
+    nodes[node_count++] = &node;
+    return true;
+  }
+  
+  // Bus speed used for pacing, 0 = send as fast as the transport accepts
+  void setBitrate(uint32_t bits_per_second) {
+    bitrate = bits_per_second;
+    bit_credit = 0;
+  }
+  
+  // Process received frames, advance the models and send what is due.
+  // Returns frames sent.
+  uint16_t step() {
+    uint32_t now = clock.micros();
+    if (!started) {
+      started = true;
+      last_step_us = now;
+    }
+    
+    VESCFrame frame;
+    while (bus.receive(frame)) {
+      rx_frames++;
+      for (uint8_t i = 0; i < node_count; i++) {
+        nodes[i]->handleFrame(frame, now);
+      }
+    }
+    for (uint8_t i = 0; i < node_count; i++) {
+      nodes[i]->advance(now);
+    }
+    
+    // Bit budget accrues with time, at most 1 ms worth carried over
+    if (bitrate != 0) {
+      bit_credit += (uint64_t)(uint32_t)(now - last_step_us) * bitrate / 1000000;
+      int64_t burst = bitrate / 1000 + canFrameBits(8);
+      if (bit_credit > burst) {
+        bit_credit = burst;
+      }
+    }
+    last_step_us = now;
+    
+    // Round-robin over nodes so one busy node cannot starve the rest
+    uint16_t sent = 0;
+    uint8_t idle = 0;
+    while (node_count > 0 && idle < node_count && sent < SIM_MAX_STEP_FRAMES) {
+      if (bitrate != 0 && bit_credit < (int64_t)canFrameBits(8)) {
+        break;
+      }
+      VESCSimNode* node = nodes[next_node];
+      next_node = (next_node + 1) % node_count;
+      if (!node->nextFrame(frame, now)) {
+        idle++;
+        continue;
+      }
+      idle = 0;
+      
+      uint32_t bits = canFrameBits(frame.len);
+      if (bitrate != 0) {
+        bit_credit -= bits;
+      }
+      if (!bus.send(frame)) {
+        tx_failed++;
+        break;  // Transport full, try again next step
+      }
+      tx_frames++;
+      tx_bits += bits;
+      sent++;
+    }
+    return sent;
+  }
+  
+  // Statistics
+  unsigned long getTxFrameCount() { return tx_frames; }
+  uint64_t getTxBitCount() { return tx_bits; }
+  unsigned long getTxFailedCount() { return tx_failed; }
+  unsigned long getRxFrameCount() { return rx_frames; }
+
+private:
+  VESCCanBus& bus;
+  VESCClock& clock;
+  VESCSimNode* nodes[SIM_MAX_NODES];
+  uint8_t node_count;
+  uint8_t next_node;
+  
+  // Pacing
+  uint32_t bitrate;
+  int64_t bit_credit;
+  uint32_t last_step_us;
+  bool started;
+  
+  unsigned long tx_frames;
+  uint64_t tx_bits;
+  unsigned long tx_failed;
+  unsigned long rx_frames;
+};
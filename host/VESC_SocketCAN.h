@@ -0,0 +1,303 @@
+#pragma once
+// Linux SocketCAN transport for the VESC protocol core.
+//
+// Runs VESCCore on a Linux SBC or dev box against can0, vcan0, ... using a
+// raw CAN socket. The kernel filters for VESC status packets and replies to
+// VESC_HOST_ID (CAN_RAW_FILTER),
+// frames are read in batches with recvmmsg() and carry the kernel's software
+// receive timestamp, moved from CLOCK_REALTIME onto VESCHostClock's
+// CLOCK_MONOTONIC. Hardware stamps run on the adapter's own clock; the
+// latest one is kept separately.
+//
+// Header-only, C++11. Build with:
+//   g++ -std=c++11 -O2 -I../Arduino_Library your_app.cpp
+#include <errno.h>
+#include <fcntl.h>
+#include <net/if.h>
+#include <poll.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+#include <linux/can.h>
+#include <linux/can/raw.h>
+#include <linux/errqueue.h>
+#include <linux/net_tstamp.h>
+#include "VESC_Core.h"
+
+// Frames fetched per recvmmsg() call
+constexpr unsigned int SOCKETCAN_BATCH = 32;
+
+// VESCClock on CLOCK_MONOTONIC, so NTP steps and manual clock changes
+// cannot fire or stall timeouts
+class VESCHostClock : public VESCClock {
+public:
+  uint32_t millis() override {
+    return (uint32_t)(now() / 1000);
+  }
+  
+  uint32_t micros() override {
+    return (uint32_t)now();
+  }
+  
+  static uint64_t now() {
+    return read(CLOCK_MONOTONIC);
+  }
+  
+  // Add to a CLOCK_REALTIME time in microseconds to get now()'s time base
+  static int64_t realtimeOffset() {
+    uint64_t mono = read(CLOCK_MONOTONIC);
+    return (int64_t)(mono - read(CLOCK_REALTIME));
+  }
+  
+  static uint64_t read(clockid_t id) {
+    struct timespec ts;
+    clock_gettime(id, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+  }
+};
+
+// VESCCanBus on a CAN_RAW socket
+class VESCSocketCANBus : public VESCCanBus {
+public:
+  VESCSocketCANBus()
+    : fd(-1), batch_count(0), batch_next(0), rx_frames(0), rx_hw_stamped(0),
+      tx_failed(0), last_hw_stamp_ns(0), hw_filter(false) {
+    memset(msgs, 0, sizeof(msgs));
+  }
+  
+  ~VESCSocketCANBus() {
+    close();
+  }
+  
+  // Open and bind the interface, e.g. "can0" or "vcan0"
+  bool open(const char* ifname) {
+    close();
+    fd = socket(PF_CAN, SOCK_RAW, CAN_RAW);
+    if (fd < 0) {
+      return false;
+    }
+    
+    struct ifreq ifr;
+    memset(&ifr, 0, sizeof(ifr));
+    strncpy(ifr.ifr_name, ifname, IFNAMSIZ - 1);
+    if (ioctl(fd, SIOCGIFINDEX, &ifr) < 0) {
+      close();
+      return false;
+    }
+    
+    struct sockaddr_can addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.can_family = AF_CAN;
+    addr.can_ifindex = ifr.ifr_ifindex;
+    if (bind(fd, (struct sockaddr*)&addr, sizeof(addr)) < 0) {
+      close();
+      return false;
+    }
+    
+    // Prefer hardware receive timestamps, fall back to the kernel's own
+    int stamping = SOF_TIMESTAMPING_RX_HARDWARE | SOF_TIMESTAMPING_RAW_HARDWARE |
+                   SOF_TIMESTAMPING_RX_SOFTWARE | SOF_TIMESTAMPING_SOFTWARE;
+    setsockopt(fd, SOL_SOCKET, SO_TIMESTAMPING, &stamping, sizeof(stamping));
+    
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+    
+    for (unsigned int i = 0; i < SOCKETCAN_BATCH; i++) {
+      iov[i].iov_base = &frames[i];
+      iov[i].iov_len = sizeof(frames[i]);
+      msgs[i].msg_hdr.msg_iov = &iov[i];
+      msgs[i].msg_hdr.msg_iovlen = 1;
+      msgs[i].msg_hdr.msg_control = control[i];
+    }
+    
+    return setHardwareFilter(true);
+  }
+  
+  void close() {
+    if (fd >= 0) {
+      ::close(fd);
+      fd = -1;
+    }
+    batch_count = batch_next = 0;
+  }
+  
+  // Kernel-side filtering: one CAN_RAW_FILTER entry per VESC status packet,
+  // any controller ID, and one per reply packet addressed to VESC_HOST_ID.
+  // Disabled, every frame on the interface is delivered.
+  bool setHardwareFilter(bool enabled) {
+    if (fd < 0) {
+      return false;
+    }
+    struct can_filter filters[VESC_STATUS_PACKET_COUNT + VESC_REPLY_PACKET_COUNT];
+    socklen_t size = 0;
+    
+    if (enabled) {
+      for (uint8_t i = 0; i < VESC_STATUS_PACKET_COUNT; i++) {
+        filters[i].can_id = CAN_EFF_FLAG | ((canid_t)VESC_STATUS_PACKETS[i] << 8);
+        filters[i].can_mask = CAN_EFF_FLAG | CAN_RTR_FLAG | 0x1FFFFF00;
+      }
+      for (uint8_t i = 0; i < VESC_REPLY_PACKET_COUNT; i++) {
+        struct can_filter& f = filters[VESC_STATUS_PACKET_COUNT + i];
+        f.can_id = CAN_EFF_FLAG | ((canid_t)VESC_REPLY_PACKETS[i] << 8) | VESC_HOST_ID;
+        f.can_mask = CAN_EFF_FLAG | CAN_RTR_FLAG | CAN_EFF_MASK;
+      }
+      size = sizeof(filters);
+    } else {
+      filters[0].can_id = 0;
+      filters[0].can_mask = 0;
+      size = sizeof(filters[0]);
+    }
+    
+    bool ok = setsockopt(fd, SOL_CAN_RAW, CAN_RAW_FILTER, filters, size) == 0;
+    hw_filter = ok && enabled;
+    return ok;
+  }
+  
+  bool isHardwareFilterEnabled() {
+    return hw_filter;
+  }
+  
+  int getFd() {
+    return fd;
+  }
+  
+  // Block until a frame is readable or timeout_ms passes (-1 = forever)
+  bool wait(int timeout_ms) {
+    if (batch_next < batch_count) {
+      return true;
+    }
+    struct pollfd pfd = { fd, POLLIN, 0 };
+    return poll(&pfd, 1, timeout_ms) > 0;
+  }
+  
+  // VESCCanBus
+  bool send(const VESCFrame& frame) override {
+    struct can_frame cf;
+    memset(&cf, 0, sizeof(cf));
+    cf.can_id = frame.id;  // Same flag layout as VESCFrame
+    cf.can_dlc = frame.len;
+    memcpy(cf.data, frame.data, frame.len);
+    
+    if (fd < 0 || write(fd, &cf, sizeof(cf)) != (ssize_t)sizeof(cf)) {
+      tx_failed++;
+      return false;
+    }
+    return true;
+  }
+  
+  bool receive(VESCFrame& frame) override {
+    if (batch_next >= batch_count && !fillBatch()) {
+      return false;
+    }
+    unsigned int i = batch_next++;
+    frame.id = frames[i].can_id;
+    frame.len = frames[i].can_dlc > 8 ? 8 : frames[i].can_dlc;
+    memcpy(frame.data, frames[i].data, frame.len);
+    frame.timestamp = timestamps[i];
+    return true;
+  }
+  
+  uint16_t pending() override {
+    if (batch_next >= batch_count) {
+      fillBatch();
+    }
+    return batch_count - batch_next;
+  }
+  
+  // Statistics
+  unsigned long getRxFrameCount() { return rx_frames; }
+  unsigned long getHardwareStampedCount() { return rx_hw_stamped; }
+  unsigned long getTxFailedCount() { return tx_failed; }
+  uint64_t getLastHardwareTimestamp() { return last_hw_stamp_ns; } // Adapter clock, ns
+
+private:
+  int fd;
+  
+  // recvmmsg() batch
+  struct can_frame frames[SOCKETCAN_BATCH];
+  struct iovec iov[SOCKETCAN_BATCH];
+  struct mmsghdr msgs[SOCKETCAN_BATCH];
+  char control[SOCKETCAN_BATCH][CMSG_SPACE(sizeof(struct scm_timestamping))];
+  uint32_t timestamps[SOCKETCAN_BATCH];
+  unsigned int batch_count;
+  unsigned int batch_next;
+  
+  unsigned long rx_frames;
+  unsigned long rx_hw_stamped;
+  unsigned long tx_failed;
+  uint64_t last_hw_stamp_ns;
+  bool hw_filter;
+  
+  // Read up to SOCKETCAN_BATCH frames in one system call
+  bool fillBatch() {
+    batch_count = batch_next = 0;
+    if (fd < 0) {
+      return false;
+    }
+    for (unsigned int i = 0; i < SOCKETCAN_BATCH; i++) {
+      msgs[i].msg_hdr.msg_controllen = sizeof(control[i]);
+      msgs[i].msg_hdr.msg_flags = 0;
+    }
+    
+    int n = recvmmsg(fd, msgs, SOCKETCAN_BATCH, MSG_DONTWAIT, nullptr);
+    if (n <= 0) {
+      return false;
+    }
+    
+    // Kernel stamps are CLOCK_REALTIME; the offset is taken once per batch
+    // so a clock step between batches is followed, not baked in
+    int64_t offset = VESCHostClock::realtimeOffset();
+    for (int i = 0; i < n; i++) {
+      timestamps[i] = frameTimestamp(msgs[i].msg_hdr, offset);
+    }
+    batch_count = n;
+    rx_frames += n;
+    return true;
+  }
+  
+  // ts[0] is the software stamp (CLOCK_REALTIME), ts[2] the raw hardware one
+  uint32_t frameTimestamp(struct msghdr& hdr, int64_t offset) {
+    for (struct cmsghdr* cmsg = CMSG_FIRSTHDR(&hdr); cmsg != nullptr; cmsg = CMSG_NXTHDR(&hdr, cmsg)) {
+      if (cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_TIMESTAMPING) {
+        continue;
+      }
+      struct scm_timestamping stamps;
+      memcpy(&stamps, CMSG_DATA(cmsg), sizeof(stamps));
+      if (stamps.ts[2].tv_sec != 0 || stamps.ts[2].tv_nsec != 0) {
+        last_hw_stamp_ns = (uint64_t)stamps.ts[2].tv_sec * 1000000000 + stamps.ts[2].tv_nsec;
+        rx_hw_stamped++;
+      }
+      if (stamps.ts[0].tv_sec != 0 || stamps.ts[0].tv_nsec != 0) {
+        uint64_t real = (uint64_t)stamps.ts[0].tv_sec * 1000000 + stamps.ts[0].tv_nsec / 1000;
+        return (uint32_t)(real + offset);
+      }
+    }
+    return (uint32_t)VESCHostClock::now();
+  }
+};
+
+// VESCCore on SocketCAN - the Linux counterpart of VESC_API
+class VESC_Linux : public VESCCore {
+public:
+  VESC_Linux() : VESCCore(socketBus, hostClock) {}
+  
+  bool init(const char* ifname = "can0") {
+    return socketBus.open(ifname);
+  }
+  
+  VESCSocketCANBus& getBus() {
+    return socketBus;
+  }
+
+protected:
+  // Blocking requests sleep on the socket instead of spinning
+  void waitForReply() override {
+    socketBus.wait(1);
+    update(0, 0);
+  }
+
+private:
+  VESCSocketCANBus socketBus;
+  VESCHostClock hostClock;
+};
@@ -0,0 +1,214 @@
+// Benchmarks for the portable protocol core
+// Times the decode, encode and update() hot paths on the host so changes to
+// VESC_Core.h can be compared before they go to the ESP32. Absolute numbers
+// are for this machine; compare runs on the same box.
+//
+// Build: g++ -std=c++11 -O2 -I../Arduino_Library vesc_bench.cpp -o vesc_bench
+// Run:   ./vesc_bench [iterations] > results.jsonl
+//
+// Output is one JSON object per line:
+//   {"bench":"decode","packet":9,"ns":4.1}           per status message type
+//   {"bench":"decode_mixed","frames_per_sec":2.4e8}  all types interleaved
+//   {"bench":"encode","cmd":1,"ns":1.2}              encodeCommand()
+//   {"bench":"set","cmd":1,"ns":2.0}                 setX(), float conversion included
+//   {"bench":"update","burst":16,"ns":60,"ns_per_frame":3.8}
+//   {"bench":"crc16","impl":"slice4","bytes":128,"ns":90,"mb_per_sec":1400}  bitwise, bytewise, slice4
+// Each figure is the best of BENCH_RUNS runs.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <chrono>
+#include "VESC_Sim.h"
+
+constexpr int BENCH_RUNS = 5;
+constexpr uint16_t BENCH_MAX_BURST = 64;
+constexpr uint16_t BENCH_CRC_MAX = 512;  // Largest buffer transfer timed
+
+// Keeps the optimizer from dropping work whose result is never used
+static inline void clobber() {
+  asm volatile("" ::: "memory");
+}
+
+static inline void escape(void* p) {
+  asm volatile("" : : "g"(p) : "memory");
+}
+
+static double nowNs() {
+  return std::chrono::duration<double, std::nano>(
+    std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// VESCCanBus that replays a fixed set of frames and discards what is sent
+class ReplayBus : public VESCCanBus {
+public:
+  ReplayBus() : count(0), next(0), sent(0) {}
+  
+  void load(const VESCFrame* source, uint16_t n) {
+    memcpy(frames, source, n * sizeof(VESCFrame));
+    count = n;
+    next = 0;
+  }
+  
+  void rewind() { next = 0; }
+  
+  bool send(const VESCFrame& frame) override {
+    sent += frame.len;
+    clobber();
+    return true;
+  }
+  
+  bool receive(VESCFrame& frame) override {
+    if (next >= count) {
+      return false;
+    }
+    frame = frames[next++];
+    return true;
+  }
+  
+  uint16_t pending() override {
+    return count - next;
+  }
+
+private:
+  VESCFrame frames[BENCH_MAX_BURST];
+  uint16_t count;
+  uint16_t next;
+  unsigned long sent;
+};
+
+// A realistic status frame from the simulator, for every status packet
+static void makeStatusFrames(VESCFrame* frames) {
+  VESCSimNode node(VESC_ID);
+  VESCFrame command;
+  VESCCore::encodeCommand(command, CMD_SET_CURRENT, VESC_ID, 20000);
+  node.advance(0);
+  node.handleFrame(command, 0);
+  for (uint32_t t = 1000; t <= 500000; t += 1000) {
+    node.advance(t);  // Spin up so the frames carry non-trivial values
+  }
+  node.setSaturate(true);
+  for (uint8_t i = 0; i < VESC_STATUS_PACKET_COUNT; i++) {
+    if (VESC_STATUS_PACKETS[i] == PACKET_STATUS_6_ALT) {
+      node.setRate(PACKET_STATUS_6_ALT, 10);
+    }
+    // Cycle until the simulator emits this packet
+    do {
+      node.nextFrame(frames[i], 500000);
+    } while (((frames[i].id >> 8) & 0xFF) != VESC_STATUS_PACKETS[i]);
+  }
+}
+
+// Best-of-runs time in ns for one call of fn
+template <typename F>
+static double timeEach(long iterations, F fn) {
+  double best = 1e30;
+  for (int run = 0; run < BENCH_RUNS; run++) {
+    double start = nowNs();
+    for (long i = 0; i < iterations; i++) {
+      fn(i);
+      clobber();
+    }
+    double ns = (nowNs() - start) / iterations;
+    best = ns < best ? ns : best;
+  }
+  return best;
+}
+
+int main(int argc, char** argv) {
+  long iterations = argc > 1 ? atol(argv[1]) : 2000000;
+  
+  ReplayBus bus;
+  VESCSimClock clock;
+  VESCCore core(bus, clock);
+  VESCFrame status[VESC_STATUS_PACKET_COUNT];
+  makeStatusFrames(status);
+  
+  printf("{\"bench\":\"meta\",\"iterations\":%ld,\"runs\":%d,\"max_nodes\":%d}\n",
+         iterations, BENCH_RUNS, VESC_MAX_NODES);
+  
+  // Decode, per status type
+  for (uint8_t i = 0; i < VESC_STATUS_PACKET_COUNT; i++) {
+    const VESCFrame& frame = status[i];
+    double ns = timeEach(iterations, [&](long) { core.parseVESCMessage(frame); });
+    printf("{\"bench\":\"decode\",\"packet\":%u,\"ns\":%.2f}\n", VESC_STATUS_PACKETS[i], ns);
+  }
+  
+  // Decode, all types interleaved (defeats per-type branch prediction)
+  double mixed = timeEach(iterations, [&](long i) {
+    core.parseVESCMessage(status[i % VESC_STATUS_PACKET_COUNT]);
+  });
+  printf("{\"bench\":\"decode_mixed\",\"frames_per_sec\":%.0f,\"ns\":%.2f}\n", 1e9 / mixed, mixed);
+  
+  // Frames update() has to look at and throw away
+  VESCFrame foreign = status[0];
+  foreign.id = 0x18FF50E5 | CAN_ID_EXTENDED;  // J1939-style BMS frame
+  double ignored = timeEach(iterations, [&](long) { core.parseVESCMessage(foreign); });
+  printf("{\"bench\":\"decode_ignored\",\"ns\":%.2f}\n", ignored);
+  
+  // Command encoding
+  static const VESCCommandID commands[] = {
+    CMD_SET_DUTY, CMD_SET_CURRENT, CMD_SET_CURRENT_BRAKE, CMD_SET_RPM
+  };
+  for (VESCCommandID cmd : commands) {
+    VESCFrame frame;
+    double ns = timeEach(iterations, [&](long i) {
+      VESCCore::encodeCommand(frame, cmd, VESC_ID, (int32_t)i);
+      escape(&frame);
+    });
+    printf("{\"bench\":\"encode\",\"cmd\":%d,\"ns\":%.2f}\n", cmd, ns);
+  }
+  
+  // Setters end to end: float conversion, encoding and the bus call
+  volatile float value = 12.5f;
+  double set_ns[4] = {
+    timeEach(iterations, [&](long) { core.setDutyCycle(value); }),
+    timeEach(iterations, [&](long) { core.setCurrent(value); }),
+    timeEach(iterations, [&](long) { core.setCurrentBrake(value); }),
+    timeEach(iterations, [&](long) { core.setRPM(value); })
+  };
+  for (uint8_t i = 0; i < 4; i++) {
+    printf("{\"bench\":\"set\",\"cmd\":%d,\"ns\":%.2f}\n", commands[i], set_ns[i]);
+  }
+  
+  // update() with a burst of queued frames, unbudgeted
+  VESCFrame burst[BENCH_MAX_BURST];
+  for (uint16_t i = 0; i < BENCH_MAX_BURST; i++) {
+    burst[i] = status[i % VESC_STATUS_PACKET_COUNT];
+  }
+  for (uint16_t size = 1; size <= BENCH_MAX_BURST; size *= 2) {
+    bus.load(burst, size);
+    long reps = iterations / size + 1;
+    double ns = timeEach(reps, [&](long) {
+      bus.rewind();
+      core.update(0, 0);
+    });
+    printf("{\"bench\":\"update\",\"burst\":%u,\"ns\":%.2f,\"ns_per_frame\":%.2f}\n",
+           size, ns, ns / size);
+  }
+  
+  // CRC16 over buffer transfer sizes: a GET_VALUES reply is about 75 bytes
+  struct CrcImpl {
+    const char* name;
+    uint16_t (*fn)(uint16_t crc, const uint8_t* buf, uint32_t len);
+  };
+  static const CrcImpl crcs[] = {
+    {"bitwise", crc16_bitwise}, {"bytewise", crc16_bytewise}, {"slice4", crc16_slice4}
+  };
+  static uint8_t payload[BENCH_CRC_MAX];
+  for (uint16_t i = 0; i < BENCH_CRC_MAX; i++) {
+    payload[i] = (uint8_t)(i * 31 + 7);
+  }
+  for (uint16_t size = 8; size <= BENCH_CRC_MAX; size *= 4) {
+    long reps = iterations / size + 1;
+    for (const CrcImpl& impl : crcs) {
+      volatile uint16_t sink = 0;
+      double ns = timeEach(reps, [&](long) {
+        escape(payload);
+        sink = impl.fn(0, payload, size);
+      });
+      printf("{\"bench\":\"crc16\",\"impl\":\"%s\",\"bytes\":%u,\"ns\":%.2f,\"mb_per_sec\":%.0f}\n",
+             impl.name, size, ns, size / ns * 1000);
+    }
+  }
+  return 0;
+}
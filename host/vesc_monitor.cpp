@@ -0,0 +1,43 @@
+// VESC Telemetry Monitor for Linux
+// The SocketCAN counterpart of examples/telemetry_basic.
+//
+// Build: g++ -std=c++11 -O2 -I../Arduino_Library vesc_monitor.cpp -o vesc_monitor
+// Run:   ./vesc_monitor can0        (or vcan0 together with vesc_sim)
+
+#include <stdio.h>
+#include "VESC_SocketCAN.h"
+
+VESC_Linux vesc;
+
+int main(int argc, char** argv) {
+  const char* ifname = argc > 1 ? argv[1] : "can0";
+  
+  if (!vesc.init(ifname)) {
+    fprintf(stderr, "ERROR: could not open %s: %s\n", ifname, strerror(errno));
+    return 1;
+  }
+  printf("Listening for VESC messages on %s...\n", ifname);
+  
+  uint32_t lastPrint = 0;
+  for (;;) {
+    vesc.getBus().wait(100);
+    vesc.update(0, 0);  // Nothing else to do here, drain everything
+    
+    uint32_t now = VESCHostClock::now() / 1000;
+    if (now - lastPrint < 1000) {
+      continue;
+    }
+    lastPrint = now;
+    
+    for (uint8_t i = 0; i < vesc.getNodeCount(); i++) {
+      uint8_t id = vesc.getNodeID(i);
+      printf("VESC %3u %s | RPM: %7d | Voltage: %5.1fV | Motor: %6.2fA | Battery: %6.2fA | Duty: %5.1f%% | FET: %5.1fC\n",
+             id, vesc.isConnected(id) ? "OK  " : "LOST",
+             (int)vesc.getRPMInt(id), vesc.getVoltage(id), vesc.getMotorCurrent(id),
+             vesc.getBatteryCurrent(id), vesc.getDuty(id), vesc.getFETTemp(id));
+    }
+    printf("frames: %lu (hw stamped: %lu, ignored: %lu)\n",
+           vesc.getBus().getRxFrameCount(), vesc.getBus().getHardwareStampedCount(),
+           vesc.getIgnoredFrameCount());
+  }
+}
@@ -0,0 +1,818 @@
+// Regression tests for the portable protocol core
+// Runs VESCCore against VESCLoopbackBus and simulated VESCs in-process, so
+// no CAN hardware or vcan interface is needed.
+//
+// Build: g++ -std=c++11 -O2 -pthread -I../Arduino_Library vesc_test.cpp -o vesc_test
+// Run:   ./vesc_test        prints failed checks, exits non-zero if any
+#include <stdio.h>
+#include <thread>
+#include "VESC_Sim.h"
+
+static int checks = 0;
+static int failures = 0;
+
+#define CHECK(cond) check((cond), #cond, __FILE__, __LINE__)
+#define CHECK_EQ(a, b) checkEqual((long long)(a), (long long)(b), #a, #b, __FILE__, __LINE__)
+
+static void check(bool ok, const char* expr, const char* file, int line) {
+  checks++;
+  if (!ok) {
+    failures++;
+    printf("%s:%d: FAILED: %s\n", file, line, expr);
+  }
+}
+
+static void checkEqual(long long a, long long b, const char* ea, const char* eb, const char* file, int line) {
+  checks++;
+  if (a != b) {
+    failures++;
+    printf("%s:%d: FAILED: %s == %s (%lld != %lld)\n", file, line, ea, eb, a, b);
+  }
+}
+
+// Extended VESC frame carrying data[0 .. len)
+static VESCFrame makeFrame(uint8_t packet_id, uint8_t controller_id, const uint8_t* data, uint8_t len) {
+  VESCFrame frame;
+  frame.id = CAN_ID_EXTENDED | ((uint32_t)packet_id << 8) | controller_id;
+  frame.len = len;
+  memcpy(frame.data, data, len);
+  frame.timestamp = 0;
+  return frame;
+}
+
+// A core on one end of a loopback bus, with the simulator on the other
+struct Bench {
+  VESCSimClock clock;
+  VESCLoopbackBus host_bus;
+  VESCLoopbackBus sim_bus;
+  VESCCore core;
+  VESCSimulator sim;
+  
+  Bench() : host_bus(&clock), sim_bus(&clock), core(host_bus, clock), sim(sim_bus, clock) {
+    host_bus.connect(sim_bus);
+  }
+  
+  // Advance time in 1 ms steps, running the simulator and the core
+  void run(uint32_t ms) {
+    for (uint32_t i = 0; i < ms; i++) {
+      clock.advance(1000);
+      sim.step();
+      core.update(0, 0);
+    }
+  }
+};
+
+// ----------------------------------------------------------------------------
+// Status decoding
+// ----------------------------------------------------------------------------
+
+static void testStatusDecode() {
+  VESCSimClock clock;
+  VESCLoopbackBus bus;
+  VESCCore core(bus, clock);
+  
+  // STATUS_1: ERPM 12345, 25.6 A, duty 0.5
+  const uint8_t s1[] = {0x00, 0x00, 0x30, 0x39, 0x01, 0x00, 0x01, 0xF4};
+  CHECK(core.parseVESCMessage(makeFrame(PACKET_STATUS_1, VESC_ID, s1, 8)));
+  CHECK_EQ(core.getRPMInt(), 12345);
+  CHECK_EQ(core.getData().motor_current, 256);
+  CHECK_EQ(core.getDutyPermille(), 500);
+  
+  // STATUS_2: 1.5 Ah used, 0.25 Ah charged
+  const uint8_t s2[] = {0x00, 0x00, 0x3A, 0x98, 0x00, 0x00, 0x09, 0xC4};
+  CHECK(core.parseVESCMessage(makeFrame(PACKET_STATUS_2, VESC_ID, s2, 8)));
+  CHECK_EQ(core.getData().amp_hours, 15000);
+  CHECK_EQ(core.getData().amp_hours_charged, 2500);
+  
+  // STATUS_3: 50 Wh used, 2 Wh charged
+  const uint8_t s3[] = {0x00, 0x07, 0xA1, 0x20, 0x00, 0x00, 0x4E, 0x20};
+  CHECK(core.parseVESCMessage(makeFrame(PACKET_STATUS_3, VESC_ID, s3, 8)));
+  CHECK_EQ(core.getData().watt_hours, 500000);
+  CHECK_EQ(core.getData().watt_hours_charged, 20000);
+  
+  // STATUS_4: FET 45.0 C, motor 60.5 C, -3.2 A in, position 90 degrees
+  const uint8_t s4[] = {0x01, 0xC2, 0x02, 0x5D, 0xFF, 0xE0, 0x11, 0x94};
+  CHECK(core.parseVESCMessage(makeFrame(PACKET_STATUS_4, VESC_ID, s4, 8)));
+  CHECK_EQ(core.getFETTempDeciC(), 450);
+  CHECK_EQ(core.getMotorTempDeciC(), 605);
+  CHECK_EQ(core.getData().input_current, -32);
+  CHECK_EQ(core.getData().pid_position, 4500);
+  
+  // STATUS_5: tacho -1000, 48.2 V
+  const uint8_t s5[] = {0xFF, 0xFF, 0xFC, 0x18, 0x01, 0xE2, 0x00, 0x00};
+  CHECK(core.parseVESCMessage(makeFrame(PACKET_STATUS_5, VESC_ID, s5, 8)));
+  CHECK_EQ(core.getData().tacho_value, -1000);
+  CHECK_EQ(core.getVoltageMilliVolts(), 48200);
+  
+  // STATUS_6 on both packet IDs: ADC 1.0, 2.0, 3.0 V, PPM -0.5
+  const uint8_t s6[] = {0x03, 0xE8, 0x07, 0xD0, 0x0B, 0xB8, 0xFE, 0x0C};
+  CHECK(core.parseVESCMessage(makeFrame(PACKET_STATUS_6, VESC_ID, s6, 8)));
+  CHECK_EQ(core.getData().adc1, 1000);
+  CHECK_EQ(core.getData().adc2, 2000);
+  CHECK_EQ(core.getData().adc3, 3000);
+  CHECK_EQ(core.getData().ppm, -500);
+  const uint8_t s6_alt[] = {0x00, 0x01, 0x00, 0x02, 0x00, 0x03, 0x00, 0x04};
+  CHECK(core.parseVESCMessage(makeFrame(PACKET_STATUS_6_ALT, VESC_ID, s6_alt, 8)));
+  CHECK_EQ(core.getData().adc1, 1);
+  CHECK_EQ(core.getData().ppm, 4);
+  
+  CHECK(core.isConnected());
+  CHECK_EQ(core.getData().message_count, 7);
+  
+  // Other controllers get their own slot; short, standard and foreign
+  // frames are not status
+  CHECK(core.parseVESCMessage(makeFrame(PACKET_STATUS_1, 75, s1, 8)));
+  CHECK_EQ(core.getRPMInt(75), 12345);
+  CHECK_EQ(core.getNodeCount(), 2);
+  CHECK(!core.parseVESCMessage(makeFrame(PACKET_STATUS_1, VESC_ID, s1, 7)));
+  VESCFrame standard = makeFrame(PACKET_STATUS_1, VESC_ID, s1, 8);
+  standard.id &= ~CAN_ID_EXTENDED;
+  CHECK(!core.parseVESCMessage(standard));
+  VESCFrame foreign = makeFrame(PACKET_STATUS_1, VESC_ID, s1, 8);
+  foreign.id |= 0x18FF0000;
+  CHECK(!core.parseVESCMessage(foreign));
+}
+
+// A message that stopped arriving must not look fresh once micros() wraps
+static void testMessageAge() {
+  VESCSimClock clock;
+  VESCLoopbackBus bus;
+  VESCCore core(bus, clock);
+  const uint8_t s1[] = {0, 0, 0, 1, 0, 0, 0, 0};
+  const uint8_t s5[] = {0, 0, 0, 0, 0x01, 0xE2, 0, 0};
+  
+  clock.set(5000);
+  CHECK_EQ(core.getAge(STATUS_1), UINT32_MAX);
+  CHECK(core.parseVESCMessage(makeFrame(PACKET_STATUS_1, VESC_ID, s1, 8)));
+  clock.advance(250);
+  CHECK_EQ(core.getAge(STATUS_1), 250);
+  CHECK(core.isConnected(STATUS_1));
+  
+  // STATUS_5 keeps coming for exactly one micros() period, STATUS_1 does not
+  for (uint32_t i = 0; i < 4294; i++) {
+    clock.advance(1000000);
+    core.parseVESCMessage(makeFrame(PACKET_STATUS_5, VESC_ID, s5, 8));
+  }
+  clock.set(5000 + 250 + ((uint64_t)1 << 32));
+  CHECK(core.isConnected());
+  CHECK(core.isConnected(STATUS_5));
+  CHECK(!core.isConnected(STATUS_1));
+  CHECK_EQ(core.getAge(STATUS_1), VESC_AGE_MAX);
+  clock.advance(100);
+  CHECK_EQ(core.getAge(STATUS_1), VESC_AGE_MAX);
+}
+
+// ----------------------------------------------------------------------------
+// update() budget
+// ----------------------------------------------------------------------------
+
+// Loopback endpoint where every receive() takes cost_us of simulated time
+class SlowBus : public VESCLoopbackBus {
+public:
+  SlowBus(VESCSimClock& clock, uint32_t cost_us) : VESCLoopbackBus(&clock), clock(clock), cost_us(cost_us) {}
+  
+  bool receive(VESCFrame& frame) override {
+    clock.advance(cost_us);
+    return VESCLoopbackBus::receive(frame);
+  }
+  
+private:
+  VESCSimClock& clock;
+  uint32_t cost_us;
+};
+
+static void queueStatus(VESCLoopbackBus& sender, uint16_t count) {
+  const uint8_t data[8] = {0};
+  for (uint16_t i = 0; i < count; i++) {
+    CHECK(sender.send(makeFrame(PACKET_STATUS_1, VESC_ID, data, 8)));
+  }
+}
+
+static void testUpdateBudget() {
+  VESCSimClock clock;
+  VESCLoopbackBus bus(&clock);
+  VESCLoopbackBus sender(&clock);
+  bus.connect(sender);
+  VESCCore core(bus, clock);
+  
+  // The default budget drains everything queued
+  CHECK(!core.hasPendingFrames());
+  queueStatus(sender, 40);
+  CHECK(core.hasPendingFrames());
+  CHECK_EQ(core.update(), 40);
+  CHECK(!core.hasPendingFrames());
+  CHECK_EQ(core.getData().message_count, 40);
+  
+  // A frame budget leaves the rest queued for the next call
+  queueStatus(sender, 40);
+  CHECK_EQ(core.update(10, 0), 10);
+  CHECK(core.hasPendingFrames());
+  CHECK_EQ(core.update(0, 0), 30);
+  CHECK(!core.hasPendingFrames());
+  
+  core.setUpdateBudget(16, 0);
+  queueStatus(sender, 40);
+  CHECK_EQ(core.update(), 16);
+  CHECK_EQ(core.update(), 16);
+  CHECK_EQ(core.update(), 8);
+  CHECK_EQ(core.update(), 0);
+  
+  // A time budget stops after the frame that used it up
+  VESCSimClock slow_clock;
+  SlowBus slow(slow_clock, 100);
+  VESCLoopbackBus slow_sender(&slow_clock);
+  slow.connect(slow_sender);
+  VESCCore slow_core(slow, slow_clock);
+  queueStatus(slow_sender, 40);
+  CHECK_EQ(slow_core.update(0, 1000), 10);
+  CHECK(slow_core.hasPendingFrames());
+  slow_core.setUpdateBudget(0, 2000);
+  CHECK_EQ(slow_core.update(), 20);
+  CHECK_EQ(slow_core.update(5, 2000), 5);  // Whichever runs out first
+  CHECK_EQ(slow_core.update(0, 0), 5);
+  CHECK(!slow_core.hasPendingFrames());
+}
+
+// ----------------------------------------------------------------------------
+// Command encoding
+// ----------------------------------------------------------------------------
+
+static void checkCommand(const VESCFrame& frame, VESCCommandID cmd, uint8_t controller_id, int32_t value) {
+  CHECK_EQ(frame.id, CAN_ID_EXTENDED | ((uint32_t)cmd << 8) | controller_id);
+  CHECK_EQ(frame.len, 4);
+  int32_t index = 0;
+  CHECK_EQ(buffer_get_int32(frame.data, &index), value);
+}
+
+static void testCommandEncode() {
+  VESCFrame frame;
+  VESCCore::encodeCommand(frame, CMD_SET_CURRENT, 75, -123456);
+  checkCommand(frame, CMD_SET_CURRENT, 75, -123456);
+  CHECK_EQ(frame.data[0], 0xFF);
+  CHECK_EQ(frame.data[3], 0xC0);
+  VESCCore::encodeCommand(frame, CMD_SET_DUTY, VESC_ID, 50000);
+  checkCommand(frame, CMD_SET_DUTY, VESC_ID, 50000);
+  
+  // The setters scale and send
+  VESCSimClock clock;
+  VESCLoopbackBus bus;
+  VESCLoopbackBus peer;
+  bus.connect(peer);
+  VESCCore core(bus, clock);
+  
+  core.setCurrent(12.5f, 75);
+  CHECK(peer.receive(frame));
+  checkCommand(frame, CMD_SET_CURRENT, 75, 12500);
+  core.setCurrentBrake(4.0f);
+  CHECK(peer.receive(frame));
+  checkCommand(frame, CMD_SET_CURRENT_BRAKE, VESC_ID, 4000);
+  core.setRPM(-3000.0f);
+  CHECK(peer.receive(frame));
+  checkCommand(frame, CMD_SET_RPM, VESC_ID, -3000);
+  CHECK(!peer.receive(frame));
+}
+
+// ----------------------------------------------------------------------------
+// Simulated controller
+// ----------------------------------------------------------------------------
+
+static void testSimulatedNode() {
+  Bench b;
+  VESCSimNode node(VESC_ID);
+  b.sim.addNode(node);
+  
+  b.run(100);
+  CHECK(b.core.isConnected());
+  CHECK(!b.core.isConnected(75));
+  CHECK_EQ(b.core.getRPMInt(), 0);
+  float idle_voltage = b.core.getVoltage();
+  CHECK(idle_voltage > 40.0f);
+  
+  // Current spins the motor up and loads the battery
+  for (int i = 0; i < 10; i++) {
+    b.core.setCurrent(20.0f);
+    b.run(50);
+  }
+  CHECK_EQ(node.getCommandCount(), 10);
+  CHECK(b.core.getRPM() > 1000.0f);
+  CHECK(b.core.getMotorCurrent() > 15.0f);
+  CHECK(b.core.getVoltage() < idle_voltage);
+  CHECK(b.core.getAmpHours() > 0.0f);
+  
+  // Braking brings it back down
+  for (int i = 0; i < 40; i++) {
+    b.core.setCurrentBrake(20.0f);
+    b.run(50);
+  }
+  CHECK_EQ(b.core.getRPMInt(), 0);
+  
+  // The RPM loop holds the target
+  for (int i = 0; i < 40; i++) {
+    b.core.setRPM(5000.0f);
+    b.run(50);
+  }
+  CHECK(b.core.getRPM() > 4500.0f && b.core.getRPM() < 5500.0f);
+  
+  // Without commands the node times out and releases the motor
+  b.run(1500);
+  CHECK(node.getMotorCurrent() == 0.0f);
+}
+
+// ----------------------------------------------------------------------------
+// Reception statistics
+// ----------------------------------------------------------------------------
+
+// Status frame received at t_us (the transport's timestamp)
+static void feedStatus(VESCCore& core, uint8_t packet_id, uint32_t t_us) {
+  const uint8_t data[8] = {0};
+  VESCFrame frame = makeFrame(packet_id, VESC_ID, data, 8);
+  frame.timestamp = t_us;
+  CHECK(core.parseVESCMessage(frame));
+}
+
+static void testReceptionStats() {
+  VESCSimClock clock;
+  VESCLoopbackBus bus;
+  VESCCore core(bus, clock);
+  uint32_t t = 1000;
+  
+  // Steady 50 Hz: the period is learned, nothing is missed
+  for (int i = 0; i <= 100; i++, t += 20000) {
+    feedStatus(core, PACKET_STATUS_1, t);
+  }
+  const VESCMessageStats& st = core.getStats(STATUS_1);
+  CHECK_EQ(st.count, 101);
+  CHECK_EQ(st.gaps, 100);
+  CHECK_EQ(st.meanGap(), 20000);
+  CHECK_EQ(st.jitter(), 0);
+  CHECK_EQ(st.min_gap, 20000);
+  CHECK_EQ(st.max_gap, 20000);
+  CHECK_EQ(st.expected, 20000);
+  CHECK_EQ(st.missed, 0);
+  CHECK_EQ(st.outages, 0);
+  
+  // Alternating 19 / 21 ms gaps: same mean, 1 ms jitter
+  for (int i = 0; i <= 100; i++, t += i % 2 ? 19000 : 21000) {
+    feedStatus(core, PACKET_STATUS_5, t);
+  }
+  const VESCMessageStats& st5 = core.getStats(STATUS_5);
+  CHECK(st5.meanGap() >= 19900 && st5.meanGap() <= 20100);
+  CHECK(st5.jitter() >= 990 && st5.jitter() <= 1010);
+  CHECK_EQ(st5.min_gap, 19000);
+  CHECK_EQ(st5.max_gap, 21000);
+  CHECK_EQ(st5.missed, 0);
+  
+  // 10% of 200 frames dropped
+  core.resetStats();
+  CHECK_EQ(st.count, 0);
+  CHECK_EQ(st.expected, 0);  // Learned, so forgotten
+  CHECK_EQ(st.min_gap, UINT32_MAX);
+  for (int i = 0; i < 200; i++, t += 20000) {
+    if (i % 10 != 5) {
+      feedStatus(core, PACKET_STATUS_1, t);
+    }
+  }
+  CHECK_EQ(st.count, 180);
+  CHECK_EQ(st.missed, 20);
+  CHECK_EQ(st.expected, 20000);
+  CHECK_EQ(st.max_gap, 40000);
+  
+  // A gap past VESC_TIMEOUT_MS is an outage, not thousands of lost frames
+  uint32_t gaps = st.gaps;
+  t += 1500000;
+  feedStatus(core, PACKET_STATUS_1, t);
+  CHECK_EQ(st.outages, 1);
+  CHECK_EQ(st.missed, 20);
+  CHECK_EQ(st.gaps, gaps);
+  CHECK_EQ(st.max_gap, 40000);
+  
+  // 33 Hz traffic: a learned period follows it, a set 50 Hz one counts
+  // every 1.5-period gap as a lost frame
+  core.resetStats();
+  core.setExpectedRate(STATUS_2, 50);
+  for (int i = 0; i <= 20; i++, t += 30000) {
+    feedStatus(core, PACKET_STATUS_1, t);
+    feedStatus(core, PACKET_STATUS_2, t);
+  }
+  const VESCMessageStats& st2 = core.getStats(STATUS_2);
+  CHECK_EQ(st.expected, 30000);
+  CHECK_EQ(st.missed, 0);
+  CHECK_EQ(st2.expected, 20000);
+  CHECK(st2.expected_fixed);
+  CHECK_EQ(st2.missed, 20);
+  
+  // resetStats() keeps a set rate; setExpectedRate(0) goes back to learning
+  core.resetStats();
+  CHECK_EQ(st2.count, 0);
+  CHECK_EQ(st2.missed, 0);
+  CHECK_EQ(st2.expected, 20000);
+  core.setExpectedRate(STATUS_2, 0);
+  CHECK(!st2.expected_fixed);
+  
+  // Unknown controllers read as empty
+  CHECK_EQ(core.getStats(STATUS_1, 75).count, 0);
+}
+
+// ----------------------------------------------------------------------------
+// Ping
+// ----------------------------------------------------------------------------
+
+static void testPing() {
+  Bench b;
+  VESCSimNode node(VESC_ID);
+  b.sim.addNode(node);
+  
+  // Answered PINGs land in the histogram
+  for (int i = 0; i < 5; i++) {
+    CHECK(b.core.sendPing(VESC_ID, 50));
+    b.run(10);
+  }
+  CHECK_EQ(node.getPingCount(), 5);
+  CHECK_EQ(b.core.getPingStats(VESC_ID).count, 5);
+  CHECK_EQ(b.core.getPingTimeoutCount(), 0);
+  
+  // A PONG arriving after its PING expired is dropped, not recorded
+  const uint8_t pong[] = {75};
+  CHECK(b.core.sendPing(75, 10));
+  b.run(20);
+  CHECK_EQ(b.core.getPingTimeoutCount(), 1);
+  CHECK(b.core.parseVESCMessage(makeFrame(PACKET_PONG, VESC_HOST_ID, pong, 1)));
+  CHECK_EQ(b.core.getPingStats(75).count, 0);
+  
+  // Only VESC_PING_STATS_NODES controllers get a histogram
+  CHECK(b.core.sendPing(75, 10));
+  CHECK(b.core.parseVESCMessage(makeFrame(PACKET_PONG, VESC_HOST_ID, pong, 1)));
+  CHECK_EQ(b.core.getPingStats(75).count, VESC_PING_STATS_NODES > 1 ? 1 : 0);
+}
+
+// setPingInterval() keeps pinging a controller that sends no status at all,
+// as long as update() runs (the CAN task calls it on every wakeup)
+static void testPingIntervalQuietBus() {
+  Bench b;
+  VESCSimNode node(VESC_ID);
+  const VESCPacketID status[] = {PACKET_STATUS_1, PACKET_STATUS_2, PACKET_STATUS_3, PACKET_STATUS_4, PACKET_STATUS_5, PACKET_STATUS_6};
+  for (uint8_t m = 0; m < 6; m++) {
+    node.setRate(status[m], 0);
+  }
+  b.sim.addNode(node);
+  
+  b.core.setPingInterval(100);
+  b.run(1000);
+  CHECK_EQ(b.core.getNodeCount(), 0);
+  CHECK(node.getPingCount() >= 9 && node.getPingCount() <= 11);
+  CHECK_EQ(b.core.getPingStats(VESC_ID).count, node.getPingCount());
+  CHECK_EQ(b.core.getPingTimeoutCount(), 0);
+  
+  b.core.setPingInterval(0);
+  b.run(10);  // A PING already on the bus
+  unsigned long pings = node.getPingCount();
+  b.run(500);
+  CHECK_EQ(node.getPingCount(), pings);
+}
+
+// A core whose blocking calls keep simulated time and the simulator running
+class SimCore : public VESCCore {
+public:
+  SimCore(VESCCanBus& bus, VESCSimClock& clock, VESCSimulator& sim) : VESCCore(bus, clock), sim_clock(clock), sim(sim) {}
+  
+  void waitForReply() override {
+    sim_clock.advance(1000);
+    sim.step();
+    VESCCore::waitForReply();
+  }
+  
+private:
+  VESCSimClock& sim_clock;
+  VESCSimulator& sim;
+};
+
+static void testDiscovery() {
+  VESCSimClock clock;
+  VESCLoopbackBus host_bus(&clock);
+  VESCLoopbackBus sim_bus(&clock);
+  host_bus.connect(sim_bus);
+  VESCSimulator sim(sim_bus, clock);
+  SimCore core(host_bus, clock, sim);
+  
+  // More silent controllers than the default node table holds: found by PING only
+  const uint8_t silent = 6;
+  VESCSimNode nodes[silent] = {VESCSimNode(100), VESCSimNode(101), VESCSimNode(102), VESCSimNode(103), VESCSimNode(104), VESCSimNode(105)};
+  const VESCPacketID status[] = {PACKET_STATUS_1, PACKET_STATUS_2, PACKET_STATUS_3, PACKET_STATUS_4, PACKET_STATUS_5, PACKET_STATUS_6};
+  for (uint8_t i = 0; i < silent; i++) {
+    for (uint8_t m = 0; m < 6; m++) {
+      nodes[i].setRate(status[m], 0);
+    }
+    CHECK(sim.addNode(nodes[i]));
+  }
+  
+  uint8_t ids[16];
+  uint8_t found = core.discover(ids, 16);
+  CHECK_EQ(found, silent);
+  for (uint8_t i = 0; i < found && i < silent; i++) {
+    CHECK_EQ(ids[i], 100 + i);
+    CHECK_EQ(core.getPingStats(ids[i]).count, 0);
+  }
+  CHECK_EQ(core.getNodeCount(), 0);
+  CHECK_EQ(core.getPingTimeoutCount(), 0);
+  
+  // One of our own pings still pending to an ID does not hold up the sweep:
+  // that ID is left for the second pass
+  CHECK(core.sendPing(20, 400));
+  uint32_t start = clock.millis();
+  found = core.discover(ids, 16);
+  CHECK_EQ(found, silent);
+  CHECK(clock.millis() - start < 400);
+}
+
+// ----------------------------------------------------------------------------
+// Long buffers
+// ----------------------------------------------------------------------------
+
+// Feed a reply from sender to the core as the controller would send it.
+// corrupt >= 0 flips a payload byte in transit. Returns frames sent.
+static uint16_t feedReply(VESCCore& core, uint8_t sender, const uint8_t* payload, uint16_t len,
+                          int corrupt = -1) {
+  VESCFrame frame;
+  uint16_t n = 0;
+  for (; VESCCore::encodeBufferFrame(frame, n, VESC_HOST_ID, sender, payload, len, VESC_BUFFER_REPLY); n++) {
+    uint8_t packet_id = (frame.id >> 8) & 0xFF;
+    if (corrupt >= 0 && packet_id == PACKET_FILL_RX_BUFFER && frame.data[0] == corrupt / 7 * 7) {
+      frame.data[1 + corrupt % 7] ^= 0x01;
+    }
+    CHECK(core.parseVESCMessage(frame));
+  }
+  return n;
+}
+
+// COMM_GET_VALUES reply: FET 45.0 C, ERPM 12345, vq 1.5 V, then padding up to len
+static uint16_t makeValuesReply(uint8_t* payload, uint16_t len) {
+  int32_t index = 0;
+  payload[index++] = COMM_GET_VALUES;
+  for (uint8_t i = 0; i < VESC_VALUE_FIELD_COUNT; i++) {
+    switch (1UL << i) {
+      case VALUE_FET_TEMP: buffer_append_int16(payload, 450, &index); break;
+      case VALUE_RPM: buffer_append_int32(payload, 12345, &index); break;
+      case VALUE_VQ: buffer_append_int32(payload, 1500, &index); break;
+      case VALUE_MOTOR_TEMP: case VALUE_DUTY: case VALUE_VOLTAGE:
+        buffer_append_int16(payload, 0, &index);
+        break;
+      case VALUE_FAULT: case VALUE_CONTROLLER_ID:
+        payload[index++] = 0;
+        break;
+      case VALUE_MOS_TEMPS:
+        buffer_append_int16(payload, 0, &index);
+        buffer_append_int16(payload, 0, &index);
+        buffer_append_int16(payload, 0, &index);
+        break;
+      default:
+        buffer_append_int32(payload, 0, &index);
+        break;
+    }
+  }
+  for (; index < len; index++) {
+    payload[index] = (uint8_t)(index * 13);
+  }
+  return (uint16_t)index;
+}
+
+static void testLongBufferReassembly() {
+  VESCSimClock clock;
+  VESCLoopbackBus bus;
+  VESCLoopbackBus peer;  // Takes the requests
+  bus.connect(peer);
+  VESCCore core(bus, clock);
+  uint8_t payload[VESC_RX_BUFFER_SIZE];
+  
+  // 400 bytes: 37 frames at 8-bit offsets (0 .. 252), then 16-bit ones
+  uint16_t len = makeValuesReply(payload, 400);
+  uint16_t frames = 0;
+  uint16_t long_frames = 0;
+  VESCFrame frame;
+  for (; VESCCore::encodeBufferFrame(frame, frames, VESC_HOST_ID, VESC_ID, payload, len, VESC_BUFFER_REPLY); frames++) {
+    long_frames += ((frame.id >> 8) & 0xFF) == PACKET_FILL_RX_BUFFER_LONG;
+  }
+  CHECK_EQ(frames, 37 + 24 + 1);
+  CHECK_EQ(long_frames, 24);
+  
+  CHECK(core.requestValues());
+  CHECK_EQ(feedReply(core, VESC_ID, payload, len), frames);
+  CHECK_EQ(core.getRequestState(), REQUEST_DONE);
+  CHECK_EQ(core.getLastValues().fet_temp, 450);
+  CHECK_EQ(core.getLastValues().rpm, 12345);
+  CHECK_EQ(core.getLastValues().vq, 1500);
+  CHECK_EQ(core.getLastValues().fields, VALUE_ALL);
+  CHECK_EQ(core.getRPMInt(), 12345);
+  CHECK_EQ(core.getBufferErrorCount(), 0);
+  
+  // Frames out of order still check out: the CRC is recomputed in one pass
+  CHECK(core.requestValues());
+  VESCFrame first;
+  VESCCore::encodeBufferFrame(first, 0, VESC_HOST_ID, VESC_ID, payload, len, VESC_BUFFER_REPLY);
+  for (uint16_t n = 1; VESCCore::encodeBufferFrame(frame, n, VESC_HOST_ID, VESC_ID, payload, len, VESC_BUFFER_REPLY); n++) {
+    if (n == frames - 1) {
+      core.parseVESCMessage(first);
+    }
+    core.parseVESCMessage(frame);
+  }
+  CHECK_EQ(core.getRequestState(), REQUEST_DONE);
+  CHECK_EQ(core.getBufferErrorCount(), 0);
+}
+
+static void testLongBufferErrors() {
+  VESCSimClock clock;
+  VESCLoopbackBus bus;
+  VESCLoopbackBus peer;
+  bus.connect(peer);
+  VESCCore core(bus, clock);
+  uint8_t payload[VESC_RX_BUFFER_SIZE];
+  uint16_t len = makeValuesReply(payload, 100);
+  
+  // CRC mismatch: the reply is dropped and the request times out
+  CHECK(core.requestValues());
+  feedReply(core, VESC_ID, payload, len, 20);
+  CHECK_EQ(core.getBufferErrorCount(), 1);
+  CHECK_EQ(core.getRequestState(), REQUEST_PENDING);
+  clock.advance(VESC_REQUEST_TIMEOUT_MS * 1000);
+  CHECK_EQ(core.getRequestState(), REQUEST_TIMEOUT);
+  CHECK_EQ(core.getRequestTimeoutCount(), 1);
+  
+  // Late reply to the timed-out request: ignored
+  feedReply(core, VESC_ID, payload, len);
+  CHECK_EQ(core.getRequestState(), REQUEST_TIMEOUT);
+  CHECK_EQ(core.getLastValues().fields, 0);
+  
+  // Reply from another controller, or to another command: ignored
+  CHECK(core.requestValues(VESC_ID));
+  feedReply(core, 75, payload, len);
+  CHECK_EQ(core.getRequestState(), REQUEST_PENDING);
+  payload[0] = COMM_GET_VALUES_SELECTIVE;
+  feedReply(core, VESC_ID, payload, len);
+  CHECK_EQ(core.getRequestState(), REQUEST_PENDING);
+  payload[0] = COMM_GET_VALUES;
+  feedReply(core, VESC_ID, payload, len);
+  CHECK_EQ(core.getRequestState(), REQUEST_DONE);
+  CHECK_EQ(core.getBufferErrorCount(), 1);
+  
+  // Past the end of rx_buffer: fill frames and lengths are refused
+  const uint8_t fill[] = {(VESC_RX_BUFFER_SIZE - 2) >> 8, (VESC_RX_BUFFER_SIZE - 2) & 0xFF, 1, 2, 3, 4};
+  CHECK(core.parseVESCMessage(makeFrame(PACKET_FILL_RX_BUFFER_LONG, VESC_HOST_ID, fill, 6)));
+  CHECK_EQ(core.getBufferErrorCount(), 2);
+  const uint8_t process[] = {VESC_ID, VESC_BUFFER_REPLY, (VESC_RX_BUFFER_SIZE + 1) >> 8,
+                             (VESC_RX_BUFFER_SIZE + 1) & 0xFF, 0, 0};
+  CHECK(core.parseVESCMessage(makeFrame(PACKET_PROCESS_RX_BUFFER, VESC_HOST_ID, process, 6)));
+  CHECK_EQ(core.getBufferErrorCount(), 3);
+}
+
+static void testShortBuffer() {
+  VESCSimClock clock;
+  VESCLoopbackBus bus;
+  VESCLoopbackBus peer;
+  bus.connect(peer);
+  VESCCore core(bus, clock);
+  
+  // A 5-byte request goes out as one PROCESS_SHORT_BUFFER frame
+  CHECK(core.requestValuesSelective<VALUE_FAULT>());
+  VESCFrame frame;
+  CHECK(peer.receive(frame));
+  CHECK_EQ(frame.id, CAN_ID_EXTENDED | ((uint32_t)PACKET_PROCESS_SHORT_BUFFER << 8) | VESC_ID);
+  CHECK_EQ(frame.len, 7);
+  CHECK_EQ(frame.data[0], VESC_HOST_ID);
+  CHECK_EQ(frame.data[1], VESC_BUFFER_PROCESS);
+  CHECK_EQ(frame.data[2], COMM_GET_VALUES_SELECTIVE);
+  CHECK(!peer.receive(frame));
+  
+  // The 6-byte reply comes back the same way
+  uint8_t payload[6];
+  int32_t index = 0;
+  payload[index++] = COMM_GET_VALUES_SELECTIVE;
+  buffer_append_int32(payload, VALUE_FAULT, &index);
+  payload[index++] = 7;
+  CHECK_EQ(feedReply(core, VESC_ID, payload, index), 1);
+  CHECK_EQ(core.getRequestState(), REQUEST_DONE);
+  CHECK_EQ(core.getLastValues().fields, VALUE_FAULT);
+  CHECK_EQ(core.getLastValues().fault_code, 7);
+  
+  // Commands for the controller, not replies, are not handed on
+  CHECK(core.requestValues());
+  VESCCore::encodeBufferFrame(frame, 0, VESC_HOST_ID, VESC_ID, payload, 6, VESC_BUFFER_PROCESS);
+  CHECK(core.parseVESCMessage(frame));
+  CHECK_EQ(core.getRequestState(), REQUEST_PENDING);
+}
+
+// ----------------------------------------------------------------------------
+// CRC16
+// ----------------------------------------------------------------------------
+
+static void testCrc16() {
+  // CRC-16/XMODEM check value
+  const uint8_t check_string[] = {'1', '2', '3', '4', '5', '6', '7', '8', '9'};
+  CHECK_EQ(crc16_bitwise(0, check_string, 9), 0x31C3);
+  CHECK_EQ(crc16_bytewise(0, check_string, 9), 0x31C3);
+  CHECK_EQ(crc16_slice4(0, check_string, 9), 0x31C3);
+  CHECK_EQ(crc16_update(0, check_string, 9), 0x31C3);
+  CHECK_EQ(crc16(check_string, 9), 0x31C3);
+  
+  // Random buffers of every length, whole and in random chunks, from every
+  // alignment the slice-by-4 loop can see
+  uint8_t buffer[512 + 3];
+  uint32_t seed = 12345;
+  int mismatches = 0;
+  for (uint16_t len = 0; len <= 512; len++) {
+    for (uint16_t i = 0; i < sizeof(buffer); i++) {
+      seed = seed * 1103515245 + 12345;
+      buffer[i] = seed >> 16;
+    }
+    const uint8_t* data = buffer + len % 4;
+    uint16_t expected = crc16_bitwise(0, data, len);
+    uint16_t chunked = 0;
+    for (uint16_t done = 0; done < len;) {
+      seed = seed * 1103515245 + 12345;
+      uint16_t chunk = 1 + (seed >> 16) % 37;
+      chunk = chunk > len - done ? len - done : chunk;
+      chunked = crc16_update(chunked, data + done, chunk);
+      done += chunk;
+    }
+    mismatches += crc16_bytewise(0, data, len) != expected;
+    mismatches += crc16_slice4(0, data, len) != expected;
+    mismatches += chunked != expected;
+  }
+  CHECK_EQ(mismatches, 0);
+}
+
+// ----------------------------------------------------------------------------
+// Snapshots
+// ----------------------------------------------------------------------------
+
+// STATUS_1 whose three fields all derive from k, so a snapshot mixing two
+// frames shows
+static VESCFrame makeTornCheckFrame(int32_t k) {
+  uint8_t data[8];
+  int32_t index = 0;
+  buffer_append_int32(data, k, &index);
+  buffer_append_int16(data, (int16_t)k, &index);
+  buffer_append_int16(data, (int16_t)(k * 3), &index);
+  return makeFrame(PACKET_STATUS_1, VESC_ID, data, 8);
+}
+
+// One task decodes while another reads snapshots, as with the CAN task
+// decoding on the ESP32. Races only show when the two threads really run
+// at once, so this needs at least two CPUs to catch anything.
+static void testSnapshotConcurrency() {
+  if (std::thread::hardware_concurrency() < 2) {
+    printf("testSnapshotConcurrency: one CPU, torn reads cannot be provoked\n");
+  }
+  VESCSimClock clock;
+  VESCLoopbackBus bus;
+  VESCCore core(bus, clock);
+  core.parseVESCMessage(makeTornCheckFrame(0));
+  
+  const int32_t writes = 2000000;
+  std::atomic<bool> done(false);
+  std::thread writer([&]() {
+    for (int32_t k = 1; k <= writes; k++) {
+      core.parseVESCMessage(makeTornCheckFrame(k));
+    }
+    done.store(true);
+  });
+  
+  unsigned long reads = 0;
+  unsigned long torn = 0;
+  unsigned long backwards = 0;
+  int32_t last = 0;
+  VESCData snapshot;
+  while (!done.load()) {
+    core.getSnapshot(snapshot);
+    reads++;
+    torn += snapshot.motor_current != (int16_t)snapshot.rpm ||
+            snapshot.duty_cycle != (int16_t)(snapshot.rpm * 3);
+    backwards += snapshot.rpm < last;
+    last = snapshot.rpm;
+  }
+  writer.join();
+  
+  CHECK(reads > 1000);
+  CHECK_EQ(torn, 0);
+  CHECK_EQ(backwards, 0);
+  CHECK(core.getSnapshot(snapshot));
+  CHECK_EQ(snapshot.rpm, writes);
+}
+
+int main() {
+  testStatusDecode();
+  testMessageAge();
+  testUpdateBudget();
+  testCommandEncode();
+  testReceptionStats();
+  testSimulatedNode();
+  testPing();
+  testPingIntervalQuietBus();
+  testDiscovery();
+  testLongBufferReassembly();
+  testLongBufferErrors();
+  testShortBuffer();
+  testCrc16();
+  testSnapshotConcurrency();
+  
+  printf("%d checks, %d failed\n", checks, failures);
+  return failures == 0 ? 0 : 1;
+}